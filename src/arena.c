@@ -0,0 +1,142 @@
+/*
+ * Per-file arena allocator
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+/* All per-file parse state (entry tables, relocations, imported and
+ * demangled names, instruction flags) is carved out of one arena, and the
+ * whole arena is released at once when dump_file() finishes with a file.
+ * This replaces thousands of small malloc/free pairs and the mirror-image
+ * teardown walks the free functions used to do. */
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    /* allocations follow */
+};
+
+static struct arena_block *arena_head;
+
+/* Large zeroed allocations (instruction flag arrays, mostly) are mapped
+ * instead of malloc'd: anonymous pages are zero on demand, so a flag array
+ * for a multi-hundred-MiB code section only commits the pages the scanner
+ * actually touches, and we skip the up-front memset entirely. */
+
+#define ARENA_MMAP_THRESHOLD 0x20000
+
+struct arena_mapping {
+    struct arena_mapping *next;
+    void *base;
+    size_t size;
+};
+
+static struct arena_mapping *arena_mappings;
+
+void *arena_alloc(size_t size) {
+    struct arena_block *block = arena_head;
+    void *ret;
+
+    /* keep everything pointer-aligned */
+    size = (size + 7) & ~(size_t)7;
+
+    if (!block || block->used + size > block->size) {
+        size_t block_size = (size > 0x10000) ? size : 0x10000;
+        block = malloc(sizeof(*block) + block_size);
+        if (!block) {
+            perror("Out of memory");
+            exit(1);
+        }
+        block->next = arena_head;
+        block->size = block_size;
+        block->used = 0;
+        arena_head = block;
+    }
+
+    ret = (char *)(block + 1) + block->used;
+    block->used += size;
+    return ret;
+}
+
+void *arena_calloc(size_t count, size_t size) {
+    size_t total = count * size;
+    void *ret;
+
+    if (total >= ARENA_MMAP_THRESHOLD) {
+        struct arena_mapping *mapping = malloc(sizeof(*mapping));
+        if (!mapping) {
+            perror("Out of memory");
+            exit(1);
+        }
+        ret = mmap(NULL, total, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ret == MAP_FAILED) {
+            perror("Out of memory");
+            exit(1);
+        }
+        mapping->next = arena_mappings;
+        mapping->base = ret;
+        mapping->size = total;
+        arena_mappings = mapping;
+        return ret;
+    }
+
+    ret = arena_alloc(total);
+    memset(ret, 0, total);
+    return ret;
+}
+
+char *arena_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    return memcpy(arena_alloc(len), str, len);
+}
+
+void arena_reset(void) {
+    struct arena_block *block = arena_head, *next;
+    struct arena_mapping *mapping = arena_mappings, *mnext;
+
+    while (mapping) {
+        mnext = mapping->next;
+        munmap(mapping->base, mapping->size);
+        free(mapping);
+        mapping = mnext;
+    }
+    arena_mappings = NULL;
+
+    /* Keep the oldest block around so that batch runs don't reallocate a
+     * fresh arena for every file. */
+    while (block) {
+        next = block->next;
+        if (next)
+            free(block);
+        else {
+            block->used = 0;
+            arena_head = block;
+        }
+        block = next;
+    }
+}
@@ -0,0 +1,259 @@
+/*
+ * Benchmark harness for the decode and scan hot paths
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "semblance.h"
+#include "x86_instr.h"
+#include "pe.h"
+
+/* Builds `bench', a standalone harness that links the real decoder and
+ * section scanner and reports their throughput on a synthetic .text
+ * section (or the raw bytes of a user-supplied file), so that decode and
+ * scan regressions show up as numbers instead of nightly batch wall-clock. */
+
+#define CODE_SIZE   0x100000    /* 1 MiB of synthetic code */
+#define DECODE_PASSES   64
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill the buffer with blocks of representative instructions. Each block
+ * calls the next, so scanning follows the same chain a real binary would. */
+static void fill_code(byte *buf, size_t size)
+{
+    static const byte block[] = {
+        0x55,                               /* push ebp */
+        0x89, 0xe5,                         /* mov ebp, esp */
+        0x8b, 0x45, 0x08,                   /* mov eax, [ebp+8] */
+        0x05, 0x00, 0x10, 0x40, 0x00,       /* add eax, 0x401000 (reloc'd) */
+        0x85, 0xc0,                         /* test eax, eax */
+        0x74, 0x02,                         /* jz (over the xor) */
+        0x31, 0xc0,                         /* xor eax, eax */
+        0xe8, 0x00, 0x00, 0x00, 0x00,       /* call (next block) */
+        0x5d,                               /* pop ebp */
+        0xc3,                               /* ret */
+    };
+    size_t off;
+
+    for (off = 0; off + 2 * sizeof(block) <= size; off += sizeof(block))
+    {
+        dword rel = sizeof(block) - 22;     /* call at +17, length 5 */
+        memcpy(buf + off, block, sizeof(block));
+        memcpy(buf + off + 18, &rel, sizeof(rel));
+    }
+    /* terminate the last block at its ret */
+    memcpy(buf + off, block, sizeof(block));
+    buf[off + 17] = 0x90;   /* turn the call into nops */
+    buf[off + 18] = 0x90;
+    buf[off + 19] = 0x90;
+    buf[off + 20] = 0x90;
+    buf[off + 21] = 0x90;
+    memset(buf + off + sizeof(block), 0, size - off - sizeof(block));
+}
+
+static void bench_decode(const byte *buf, size_t size, int bits, int passes)
+{
+    struct instr instr;
+    unsigned long count = 0;
+    double start = now(), elapsed;
+    size_t ip;
+    int pass, len;
+
+    for (pass = 0; pass < passes; pass++)
+    {
+        for (ip = 0; ip + MAX_INSTR <= size; ip += len)
+        {
+            len = get_instr(ip, buf + ip, &instr, bits);
+            if (len <= 0) len = 1;
+            count++;
+        }
+    }
+
+    elapsed = now() - start;
+    printf("decode %2d-bit: %7.1f M instr/s, %7.1f MiB/s (%lu instructions)\n",
+        bits, count / elapsed / 1e6,
+        (double)passes * size / elapsed / 0x100000, count);
+}
+
+/* Build a single-section in-memory PE around the buffer. */
+static void make_pe(struct pe *pe, struct file_header *header,
+    struct optional_header *opt, struct directory *dirs,
+    struct section *sec, byte *buf, size_t size)
+{
+    memset(pe, 0, sizeof(*pe));
+    memset(header, 0, sizeof(*header));
+    memset(opt, 0, sizeof(*opt));
+    memset(sec, 0, sizeof(*sec));
+
+    map = buf;
+
+    header->NumberOfSections = 1;
+    opt->AddressOfEntryPoint = 0x1000;
+
+    strcpy(sec->name, ".text");
+    sec->address = 0x1000;
+    sec->length = size;
+    sec->min_alloc = size;
+    sec->offset = 0;
+    sec->flags = 0x60000020;    /* code, executable, readable */
+    sec->instr_flags = calloc(size, sizeof(byte));
+
+    pe->magic = 0x10b;
+    pe->imagebase = 0x400000;
+    pe->header = header;
+    pe->opt32 = opt;
+    pe->dirs = dirs;
+    pe->sections = sec;
+    build_section_index(pe);
+}
+
+static void bench_scan(byte *buf, size_t size)
+{
+    struct pe pe;
+    struct file_header header;
+    struct optional_header opt;
+    struct directory dirs[16] = {{0}};
+    struct section sec;
+    double start, elapsed;
+
+    make_pe(&pe, &header, &opt, dirs, &sec, buf, size);
+
+    start = now();
+    read_sections(&pe);
+    elapsed = now() - start;
+
+    printf("scan:          %7.2f ms per MiB of .text (%.1f MiB/s)\n",
+        elapsed * 1000 / ((double)size / 0x100000),
+        (double)size / elapsed / 0x100000);
+
+    free(sec.instr_flags);
+}
+
+/* Time the full formatting path, including one reloc lookup per tagged
+ * instruction, with stdout pointed at /dev/null. */
+static void bench_format(byte *buf, size_t size)
+{
+    struct pe pe;
+    struct file_header header;
+    struct optional_header opt;
+    struct directory dirs[16] = {{0}};
+    struct section sec;
+    double start, elapsed;
+    unsigned i, nrelocs = size / 24;    /* one per synthetic block */
+    int saved_stdout;
+
+    make_pe(&pe, &header, &opt, dirs, &sec, buf, size);
+
+    /* one HIGHLOW reloc on each block's add-immediate */
+    pe.relocs = calloc(nrelocs, sizeof(*pe.relocs));
+    pe.reloc_count = nrelocs;
+    for (i = 0; i < nrelocs; i++)
+    {
+        pe.relocs[i].offset = sec.address + i * 24 + 7;
+        pe.relocs[i].type = 3;
+    }
+
+    read_sections(&pe);
+
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    start = now();
+    print_sections(&pe);
+    elapsed = now() - start;
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    printf("format:        %7.2f ms per MiB of .text (%u reloc lookups, %.1f ns each)\n",
+        elapsed * 1000 / ((double)size / 0x100000),
+        nrelocs, elapsed / nrelocs * 1e9);
+
+    free(pe.relocs);
+    free(sec.instr_flags);
+}
+
+int main(int argc, char *argv[])
+{
+    byte *buf;
+    size_t size = CODE_SIZE;
+    int passes = DECODE_PASSES;
+
+    mode = DISASSEMBLE;
+    opts = 0;
+    asm_syntax = NASM;
+    pe_rel_addr = 1;
+
+    if (argc > 1)
+    {
+        /* decode the raw bytes of a user-supplied file instead */
+        struct stat st;
+        int fd;
+
+        if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+            perror(argv[1]);
+            return 1;
+        }
+        size = st.st_size;
+        buf = malloc(size + MAX_INSTR);
+        if (read(fd, buf, size) != (ssize_t)size) {
+            perror(argv[1]);
+            return 1;
+        }
+        memset(buf + size, 0, MAX_INSTR);
+        close(fd);
+        passes = (passes * CODE_SIZE > size) ? (int)(passes * CODE_SIZE / size) : 1;
+
+        printf("input: %s (%zu bytes)\n", argv[1], size);
+        bench_decode(buf, size, 16, passes);
+        bench_decode(buf, size, 32, passes);
+        bench_decode(buf, size, 64, passes);
+        return 0;
+    }
+
+    buf = malloc(size + MAX_INSTR);
+    fill_code(buf, size);
+    memset(buf + size, 0, MAX_INSTR);
+
+    printf("input: synthetic .text (%zu bytes)\n", size);
+    bench_decode(buf, size, 16, passes);
+    bench_decode(buf, size, 32, passes);
+    bench_decode(buf, size, 64, passes);
+    bench_scan(buf, size);
+    bench_format(buf, size);
+
+    return 0;
+}
@@ -27,16 +27,50 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "semblance.h"
+#include "perf.h"
+
+static const char *cache_dir;
+
+/* What the user asked for with --pe-rel-addr (-1 = decide per file).
+ * dumppe() resolves -1 into pe_rel_addr in place, so restore the choice
+ * for every file; otherwise the first file's resolution leaks into the
+ * rest of a batch and into the output cache key. */
+static int pe_rel_addr_opt = -1;
+
+/* FNV-1a; cheap and good enough to key a cache. */
+static unsigned long fnv1a(const byte *data, size_t len, unsigned long hash) {
+    while (len--) {
+        hash ^= *data++;
+        hash *= 0x100000001b3ul;
+    }
+    return hash;
+}
+
+static void copy_to_stdout(int fd) {
+    char buf[8192];
+    ssize_t len;
+
+    fflush(stdout);
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, len, stdout);
+}
 
 static void dump_file(char *file){
+    char cache_path[4096];
+    char cache_tmp[sizeof(cache_path) + 32];    /* room for ".<pid>.tmp" */
+    int cache_out = -1, saved_stdout = -1;
     struct stat st;
     word magic;
     long offset = 0;
     int fd;
 
+    pe_rel_addr = pe_rel_addr_opt;
+
     if ((fd = open(file, O_RDONLY)) < 0) {
         perror("Cannot open %s");
         return;
@@ -53,13 +87,55 @@ static void dump_file(char *file){
         perror("Cannot map %s");
         return;
     }
+    map_length = st.st_size;
+    map_mmapped = 1;
 
     magic = read_word(0);
 
-    printf("File: %s\n", file);
+    perf_begin_file();
+
+    extract_basename = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+
+    if (opts & STRUCTURED)
+        printf("file\t%s\n", file);
+    else
+        printf("File: %s\n", file);
+
+    /* The cache holds everything below the File: line, keyed by content
+     * hash plus the options that shape the output. A hit replays the
+     * formatted output without parsing or scanning anything; warnings go
+     * to stderr and are only seen on the run that fills the cache. */
+    if (cache_dir) {
+        unsigned long hash;
+        map_advise_sequential(0, st.st_size);
+        hash = fnv1a(map, st.st_size, 0xcbf29ce484222325ul);
+        word key[4] = {mode, opts, (word)asm_syntax, (word)pe_rel_addr};
+        int cache_fd;
+
+        hash = fnv1a((const byte *)key, sizeof(key), hash);
+        snprintf(cache_path, sizeof(cache_path), "%s/%016lx", cache_dir, hash);
+
+        if ((cache_fd = open(cache_path, O_RDONLY)) >= 0) {
+            copy_to_stdout(cache_fd);
+            close(cache_fd);
+            return;
+        }
+
+        snprintf(cache_tmp, sizeof(cache_tmp), "%s.%d.tmp", cache_path, getpid());
+        if ((cache_out = open(cache_tmp, O_WRONLY | O_CREAT | O_EXCL, 0666)) >= 0) {
+            fflush(stdout);
+            saved_stdout = dup(STDOUT_FILENO);
+            dup2(cache_out, STDOUT_FILENO);
+            close(cache_out);
+        } else
+            perror("Cannot write to cache");
+    }
+
     if (magic == 0x5a4d){ /* MZ */
-        offset = read_dword(0x3c);
-        magic = read_word(offset);
+        /* Don't chase e_lfanew into code or past the end of a plain DOS
+         * executable; the field only exists in NE/PE-era headers. */
+        offset = (st.st_size >= 0x40) ? read_dword(0x3c) : 0;
+        magic = (offset >= 0x40 && offset + 2 <= st.st_size) ? read_word(offset) : 0;
 
         if (magic == 0x4550)
             dumppe(offset);
@@ -70,9 +146,122 @@ static void dump_file(char *file){
     } else
         fprintf(stderr, "File format not recognized\n");
 
+    if (saved_stdout >= 0) {
+        int cache_fd;
+
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        rename(cache_tmp, cache_path);
+
+        if ((cache_fd = open(cache_path, O_RDONLY)) >= 0) {
+            copy_to_stdout(cache_fd);
+            close(cache_fd);
+        }
+    }
+
+    perf_report(file);
+
+    /* Everything the parsers allocated for this file lives in the arena. */
+    arena_reset();
+
     return;
 }
 
+/* Kick off readahead for an upcoming file while we're still busy with the
+ * current one; on a cold cache the kernel overlaps its I/O with our parsing.
+ * Any error just means no overlap, so ignore them. */
+static void prefetch_file(const char *file) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/* Dump files concurrently in forked workers. Since the whole program hangs
+ * off globals (map, the parsed ne/pe structures), a worker process per file
+ * is the safe way to get per-file state; each worker writes to an unlinked
+ * temporary file which we copy to stdout in argument order, so the output
+ * is the same as a sequential run. (That holds because dump_file() resets
+ * cross-file state like pe_rel_addr itself; each file resolves its options
+ * the same way whether or not it shares a process with its predecessors.)
+ * Workers share stderr, so warnings from different files may interleave. */
+static void dump_files_parallel(char **files, int count) {
+    pid_t *pids = malloc(count * sizeof(*pids));
+    FILE **tmps = malloc(count * sizeof(*tmps));
+    char buf[8192];
+    size_t len;
+    int started = 0, done = 0;
+
+    while (done < count) {
+        while (started < count && started - done < dump_jobs) {
+            pid_t pid;
+
+            if (started + dump_jobs < count)
+                prefetch_file(files[started + dump_jobs]);
+
+            if (!(tmps[started] = tmpfile())) {
+                perror("Cannot create temporary file");
+                exit(1);
+            }
+
+            /* don't let the worker inherit (and flush into its temporary
+             * file) output we've buffered but not written yet */
+            fflush(stdout);
+
+            if ((pid = fork()) < 0) {
+                perror("Cannot fork");
+                exit(1);
+            } else if (pid == 0) {
+                dup2(fileno(tmps[started]), STDOUT_FILENO);
+                dump_jobs = 1; /* don't fork again per section */
+                dump_file(files[started]);
+                fflush(stdout);
+                _exit(0);
+            }
+            pids[started++] = pid;
+        }
+
+        waitpid(pids[done], NULL, 0);
+        rewind(tmps[done]);
+        while ((len = fread(buf, 1, sizeof(buf), tmps[done])) > 0)
+            fwrite(buf, 1, len, stdout);
+        fclose(tmps[done]);
+        if (++done < count)
+            printf("\n\n");
+    }
+
+    free(pids);
+    free(tmps);
+}
+
+/* Append newline-separated paths from a list file (or stdin for "-") to the
+ * input set, `find ... | dump --files-from=-' style. */
+static char **read_file_list(const char *path, char **files, int *count) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char line[4096];
+    size_t len;
+
+    if (!f) {
+        perror("Cannot open file list");
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        len = strlen(line);
+        while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = 0;
+        if (!len)
+            continue;
+        files = realloc(files, (*count + 1) * sizeof(*files));
+        files[(*count)++] = strdup(line);
+    }
+
+    if (f != stdin)
+        fclose(f);
+    return files;
+}
+
 static const char help_message[] =
 "dump: tool to disassemble and print information from executable files.\n"
 "Usage: dump [options] <file(s)>\n"
@@ -83,8 +272,11 @@ static const char help_message[] =
 "\t-d, --disassemble                    Print disassembled machine code.\n"
 "\t-e, --exports                        Print exported functions.\n"
 "\t-f, --file-headers                   Print contents of the file header.\n"
+"\t--files-from=FILE                    Also dump the files listed in FILE,\n"
+"\t                                     one per line (\"-\" reads stdin).\n"
 "\t-h, --help                           Display this help message.\n"
 "\t-i, --imports                        Print imported modules.\n"
+"\t-j, --jobs=N                         Dump up to N files (or PE sections) concurrently.\n"
 "\t-M, --disassembler-options=[...]     Extended options for disassembly.\n"
 "\t\tatt        Alias for `gas'.\n"
 "\t\tgas        Use GAS syntax for disassembly.\n"
@@ -95,9 +287,15 @@ static const char help_message[] =
 "\t-s, --full-contents                  Display full contents of all sections.\n"
 "\t-v, --version                        Print the version number of semblance.\n"
 "\t-x, --all-headers                    Print all headers.\n"
+"\t--cache-dir=DIR                      Cache formatted output, keyed by\n"
+"\t                                     content hash; replay it on later runs.\n"
+"\t--extract-resource[=filter]          Write raw resources to files.\n"
 "\t--no-show-addresses                  Don't print instruction addresses.\n"
 "\t--no-show-raw-insn                   Don't print raw instruction hex code.\n"
 "\t--pe-rel-addr=[y/n]                  Use relative addresses for PE files.\n"
+"\t--perf-stats                         Print per-phase timing to stderr.\n"
+"\t--structured                         Print headers, exports, and imports as\n"
+"\t                                     tab-separated records instead of text.\n"
 ;
 
 static const struct option long_options[] = {
@@ -111,6 +309,7 @@ static const struct option long_options[] = {
 //  {"gas",                     no_argument,        NULL, 'G'},
     {"help",                    no_argument,        NULL, 'h'},
     {"imports",                 no_argument,        NULL, 'i'},
+    {"jobs",                    required_argument,  NULL, 'j'},
 //  {"masm",                    no_argument,        NULL, 'I'}, /* for "Intel" */
     {"disassembler-options",    required_argument,  NULL, 'M'},
 //  {"nasm",                    no_argument,        NULL, 'N'},
@@ -118,20 +317,28 @@ static const struct option long_options[] = {
     {"full-contents",           no_argument,        NULL, 's'},
     {"version",                 no_argument,        NULL, 'v'},
     {"all-headers",             no_argument,        NULL, 'x'},
+    {"extract-resource",        optional_argument,  NULL, 0x81},
     {"no-show-raw-insn",        no_argument,        NULL, NO_SHOW_RAW_INSN},
     {"no-prefix-addresses",     no_argument,        NULL, NO_SHOW_ADDRESSES},
     {"pe-rel-addr",             required_argument,  NULL, 0x80},
+    {"perf-stats",              no_argument,        NULL, 0x82},
+    {"structured",              no_argument,        NULL, 0x83},
+    {"cache-dir",               required_argument,  NULL, 0x84},
+    {"files-from",              required_argument,  NULL, 0x85},
     {0}
 };
 
 int main(int argc, char *argv[]){
-    int opt;
+    char **files = NULL;
+    int count = 0;
+    int opt, i;
 
+    dump_jobs = 1;
     mode = 0;
     opts = 0;
     asm_syntax = NASM;
 
-    while ((opt = getopt_long(argc, argv, "a::cCdDefhiM:osvx", long_options, NULL)) >= 0){
+    while ((opt = getopt_long(argc, argv, "a::cCdDefhij:M:osvx", long_options, NULL)) >= 0){
         switch (opt) {
         case NO_SHOW_RAW_INSN:
             opts |= NO_SHOW_RAW_INSN;
@@ -139,9 +346,22 @@ int main(int argc, char *argv[]){
         case NO_SHOW_ADDRESSES:
             opts |= NO_SHOW_ADDRESSES;
             break;
+        case 0x82: /* perf stats */
+            perf_stats = 1;
+            break;
+        case 0x83: /* structured records */
+            opts |= STRUCTURED;
+            break;
+        case 0x84: /* output cache */
+            cache_dir = optarg;
+            break;
+        case 0x85: /* file list */
+            files = read_file_list(optarg, files, &count);
+            break;
+        case 0x81: /* extract resources */
         case 'a': /* dump resources only */
         {
-            mode |= DUMPRSRC;
+            mode |= (opt == 'a') ? DUMPRSRC : EXTRACT_RSRC;
             if (optarg){
                 const char *p = optarg;
                 while (*p == ' ' || *p == '=') ++p;
@@ -174,6 +394,13 @@ int main(int argc, char *argv[]){
         case 'i': /* imports */
             mode |= DUMPIMPORT;
             break;
+        case 'j': /* parallel jobs */
+            dump_jobs = atoi(optarg);
+            if (dump_jobs < 1) {
+                fprintf(stderr, "Invalid job count `%s'.\n", optarg);
+                return 1;
+            }
+            break;
         case 'M': /* additional options */
             if (!strcmp(optarg, "att") || !strcmp(optarg, "gas"))
                 asm_syntax = GAS;
@@ -215,14 +442,25 @@ int main(int argc, char *argv[]){
     }
 
     if (mode == 0)
-        mode = ~0;
+        mode = ~0 & ~EXTRACT_RSRC; /* dump everything, but don't write files */
+
+    pe_rel_addr_opt = pe_rel_addr;
+
+    while (optind < argc) {
+        files = realloc(files, (count + 1) * sizeof(*files));
+        files[count++] = argv[optind++];
+    }
 
-    if (optind == argc)
+    if (!count)
         printf(help_message);
 
-    while (optind < argc){
-        dump_file(argv[optind++]);
-        if (optind < argc)
+    if (dump_jobs > 1 && count > 1)
+        dump_files_parallel(files, count);
+    else for (i = 0; i < count; i++) {
+        if (i + 1 < count)
+            prefetch_file(files[i + 1]);
+        dump_file(files[i]);
+        if (i + 1 < count)
             printf("\n\n");
     }
 
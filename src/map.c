@@ -0,0 +1,89 @@
+/*
+ * Page-cache hints for the input mapping
+ *
+ * Copyright 2017-2018,2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "semblance.h"
+
+/* The whole input is one read-only mapping (see dump_file()), and on a big
+ * binary we usually only care about a few windows of it: the scanner hops
+ * between branch targets inside the code sections, and each section is
+ * touched once more when it's printed. These helpers pass the per-phase
+ * access pattern through to the kernel so pages come in ahead of use and
+ * go away once their section has been dumped, instead of the whole file
+ * competing for the page cache.
+ *
+ * The library entry point hands us a caller-provided buffer rather than a
+ * mapping; madvise() doesn't apply there, so everything quietly does
+ * nothing when the base isn't page-aligned. */
+
+static void map_advise(off_t offset, size_t length, int advice, int inward)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t skew;
+
+    if (!map_length || ((uintptr_t)map & (page - 1)))
+        return;
+    if (offset < 0 || (size_t)offset >= map_length)
+        return;
+    length = min(length, map_length - offset);
+
+    skew = offset & (page - 1);
+    if (inward) {
+        /* Only whole pages can be discarded; trim to the pages this region
+         * owns outright so we don't throw away a neighbour's data. */
+        if (skew) {
+            offset += page - skew;
+            length -= min(length, page - skew);
+        }
+        length &= ~(page - 1);
+        if (!length)
+            return;
+    } else {
+        offset -= skew;
+        length += skew;
+    }
+
+    madvise(map + offset, length, advice);
+}
+
+void map_advise_sequential(off_t offset, size_t length)
+{
+    map_advise(offset, length, MADV_SEQUENTIAL, 0);
+}
+
+void map_advise_willneed(off_t offset, size_t length)
+{
+    map_advise(offset, length, MADV_WILLNEED, 0);
+}
+
+void map_advise_done(off_t offset, size_t length)
+{
+    /* Page alignment isn't ownership: a library caller's anonymous buffer
+     * can be page-aligned, and MADV_DONTNEED would throw its data away.
+     * Only drop pages from a mapping dump_file() created itself; there it
+     * just means a refault from the file if something does come back. */
+    if (!map_mmapped)
+        return;
+    map_advise(offset, length, MADV_DONTNEED, 1);
+}
@@ -23,9 +23,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "semblance.h"
 #include "x86_instr.h"
+#include "x86_scan.h"
 #include "mz.h"
+#include "output.h"
+#include "perf.h"
 
 #pragma pack(1)
 
@@ -52,7 +56,7 @@ static int print_mz_instr(dword ip, const byte *p, const byte *flags) {
 
     char ip_string[7];
 
-    len = get_instr(ip, p, &instr, 16);
+    len = get_instr16(ip, p, &instr);
 
     sprintf(ip_string, "%05x", ip);
 
@@ -74,17 +78,20 @@ static void print_code(struct mz *mz) {
             if (opts & DISASSEMBLE_ALL) {
                 /* still skip zeroes */
                 if (read_byte(mz->start + ip) == 0) {
-                    printf("      ...\n");
+                    out_str("      ...\n");
                     ip++;
                     while (read_byte(mz->start + ip) == 0) ip++;
                 }
             } else {
-                printf("     ...\n");
+                out_str("     ...\n");
                 while ((ip < mz->length) && !(mz->flags[ip] & INSTR_VALID)) ip++;
             }
         }
 
-        if (ip >= mz->length) return;
+        if (ip >= mz->length) {
+            out_flush();
+            return;
+        }
 
         /* fixme: disassemble everything for now; we'll try to fix it later.
          * this is going to be a little more difficult since dos executables
@@ -94,76 +101,90 @@ static void print_code(struct mz *mz) {
         memcpy(buffer, read_data(mz->start + ip), min(sizeof(buffer), mz->length - ip));
 
         if (mz->flags[ip] & INSTR_FUNC) {
-            printf("\n");
-            printf("%05x <no name>:\n", ip);
+            out_fmt("\n%05x <no name>:\n", ip);
         }
 
         ip += print_mz_instr(ip, buffer, mz->flags);
     }
+    out_flush();
 }
 
-static void scan_segment(dword ip, struct mz *mz) {
-    byte buffer[MAX_INSTR];
-    struct instr instr;
-    int instr_length;
-    int i;
+static int scan_resolve(qword target, struct scan_region *reg, dword *relip, void *ctx) {
+    struct mz *mz = ctx;
+    dword ip = target;
 
     if (ip > mz->length) {
         warn_at("Attempt to scan past end of segment.\n");
-        return;
+        return 0;
     }
 
-    if ((mz->flags[ip] & (INSTR_VALID|INSTR_SCANNED)) == INSTR_SCANNED)
-        warn_at("Attempt to scan byte that does not begin instruction.\n");
-
-    while (ip < mz->length) {
-        /* check if we already read from here */
-        if (mz->flags[ip] & INSTR_SCANNED) return;
-
-        /* read the instruction */
-        memset(buffer, 0, sizeof(buffer));  // fixme
-        memcpy(buffer, read_data(mz->start + ip), min(sizeof(buffer), mz->length - ip));
-        instr_length = get_instr(ip, buffer, &instr, 16);
-
-        /* mark the bytes */
-        mz->flags[ip] |= INSTR_VALID;
-        for (i = ip; i < ip+instr_length && i < mz->length; i++) mz->flags[i] |= INSTR_SCANNED;
-
-        /* instruction which hangs over the minimum allocation */
-        if (i < ip+instr_length && i == mz->length) break;
+    reg->start = mz->start;
+    reg->base = 0;
+    reg->length = mz->length;
+    reg->min_alloc = mz->length;
+    reg->flags = mz->flags;
+    reg->bits = 16;
+    *relip = ip;
+    return 1;
+}
 
-        /* handle conditional and unconditional jumps */
-        if (instr.op.flags & OP_BRANCH) {
-            /* near relative jump, loop, or call */
-            if (!strcmp(instr.op.name, "call"))
-                mz->flags[instr.args[0].value] |= INSTR_FUNC;
+static void scan_visit(struct instr *instr, dword relip, int instr_length,
+    const struct scan_region *reg, void *ctx)
+{
+    struct mz *mz = ctx;
+    dword ip = relip;
+    qword tip;
+
+    if (instr->op.arg0 == PTR32) {
+        /* Far call or jump. MZ relocation adds the load segment to every
+         * fixup site uniformly, so the segment stored in the file is already
+         * relative to the start of the image—the same space we scan in. */
+        tip = realaddr(read_word(mz->start + instr->args[0].ip + 2), instr->args[0].value);
+        if (tip < mz->length) {
+            if (!strcmp(instr->op.name, "call"))
+                mz->flags[tip] |= INSTR_FUNC | INSTR_FAR;
             else
-                mz->flags[instr.args[0].value] |= INSTR_JUMP;
-
-            /* scan it */
-            scan_segment(instr.args[0].value, mz);
-        }
-
-        if (instr.op.flags & OP_STOP)
-            return;
-
-        ip += instr_length;
+                mz->flags[tip] |= INSTR_JUMP | INSTR_FAR;
+            scan_push(tip);
+        } else
+            warn_at("Far branch '%s' to byte %lx not in segment.\n", instr->op.name, tip);
+    } else if (instr->op.flags & OP_BRANCH) {
+        /* near relative jump, loop, or call */
+        tip = instr->args[0].value;
+        if (tip < mz->length) {
+            if (!strcmp(instr->op.name, "call"))
+                mz->flags[tip] |= INSTR_FUNC;
+            else
+                mz->flags[tip] |= INSTR_JUMP;
+            scan_push(tip);
+        } else
+            warn_at("Branch '%s' to byte %lx not in segment.\n", instr->op.name, tip);
     }
+}
 
-    warn_at("Scan reached the end of segment.\n");
+static void scan_warn(qword addr, const char *msg, void *ctx) {
+    dword ip = addr;
+    warn_at("%s", msg);
 }
 
 static void read_code(struct mz *mz) {
+    struct scan_format fmt = { scan_resolve, scan_visit, scan_warn,
+        "Scan reached the end of segment.\n", mz };
 
     mz->entry_point = realaddr(mz->header->e_cs, mz->header->e_ip);
     mz->length = ((mz->header->e_cp - 1) * 512) + mz->header->e_cblp;
     if (mz->header->e_cblp == 0) mz->length += 512;
-    mz->flags = calloc(mz->length, sizeof(byte));
+    mz->flags = arena_calloc(mz->length, sizeof(byte));
 
     if (mz->entry_point > mz->length)
         warn("Entry point %05x exceeds segment length (%05x)\n", mz->entry_point, mz->length);
-    mz->flags[mz->entry_point] |= INSTR_FUNC;
-    scan_segment(mz->entry_point, mz);
+    if (mz->entry_point < mz->length)
+        mz->flags[mz->entry_point] |= INSTR_FUNC;
+    perf_enter(PERF_SCAN);
+    map_advise_willneed(mz->start, mz->length);
+    scan_push(mz->entry_point);
+    scan_run(&fmt);
+    perf_leave(PERF_SCAN);
 }
 
 void readmz(struct mz *mz) {
@@ -177,8 +198,20 @@ void readmz(struct mz *mz) {
     read_code(mz);
 }
 
-void freemz(struct mz *mz) {
-    free(mz->flags);
+/* Emit the same information as print_header(), but as tab-separated
+ * records that scripts can split without a regex for every line. */
+static void print_structured(struct mz *mz)
+{
+    printf("module\tmz\n");
+
+    if (mode & DUMPHEADER) {
+        const struct header_mz *header = mz->header;
+        printf("header\tminalloc\t%d\n", header->e_minalloc * 16);
+        printf("header\tmaxalloc\t%d\n", header->e_maxalloc * 16);
+        printf("header\tstack_location\t%#x\n", realaddr(header->e_ss, header->e_sp));
+        printf("header\tentry_point\t%#x\n", realaddr(header->e_cs, header->e_ip));
+        printf("header\toverlay\t%d\n", header->e_ovno);
+    }
 }
 
 void dumpmz(void) {
@@ -186,13 +219,19 @@ void dumpmz(void) {
 
     readmz(&mz);
 
+    if (opts & STRUCTURED) {
+        print_structured(&mz);
+        return;
+    }
+
     printf("Module type: MZ (DOS executable)\n");
 
     if (mode & DUMPHEADER)
         print_header(mz.header);
 
-    if (mode & DISASSEMBLE)
+    if (mode & DISASSEMBLE) {
+        perf_enter(PERF_FORMAT);
         print_code(&mz);
-
-    freemz(&mz);
+        perf_leave(PERF_FORMAT);
+    }
 }
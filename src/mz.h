@@ -55,6 +55,5 @@ struct mz {
 };
 
 extern void readmz(struct mz *mz);
-extern void freemz(struct mz *mz);
 
 #endif /* __MZ_H */
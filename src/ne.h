@@ -53,6 +53,13 @@ struct entry {
     char *name;     /* may be NULL */
 };
 
+/* sorted (segment:offset -> entry) index, built once the entry table is read */
+struct entry_index {
+    word segment;
+    word offset;
+    unsigned index;     /* into enttab */
+};
+
 struct export {
     word ordinal;
     char *name;
@@ -74,6 +81,12 @@ struct reloc {
     char *text;
 };
 
+/* sorted (offset -> reloc) index, built once all relocations are read */
+struct reloc_offset {
+    word offset;
+    word index;     /* into reloc_table */
+};
+
 struct segment {
     word cs;
     long start;
@@ -83,6 +96,8 @@ struct segment {
     byte *instr_flags;
     struct reloc *reloc_table;
     word reloc_count;
+    struct reloc_offset *reloc_offsets;
+    unsigned reloc_offset_count;
 };
 
 struct ne {
@@ -97,6 +112,7 @@ struct ne {
 
     struct entry *enttab;
     unsigned entcount;
+    struct entry_index *entidx;
 
     struct import_module *imptab;
 
@@ -104,13 +120,11 @@ struct ne {
 };
 
 extern void readne(long offset_ne, struct ne *ne);
-extern void freene(struct ne *ne);
 
 /* in ne_resource.c */
 extern void print_rsrc(off_t start);
 /* in ne_segment.c */
 extern void read_segments(off_t start, struct ne *ne);
-extern void free_segments(struct ne *ne);
 extern void print_segments(struct ne *ne);
 
 #endif /* __NE_H */
@@ -24,9 +24,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
+#include "arena.h"
 #include "semblance.h"
 #include "ne.h"
+#include "perf.h"
 
 static void print_flags(word flags){
     char buffer[1024];
@@ -146,23 +149,45 @@ static void print_specfile(struct ne *ne) {
     fclose(specfile);
 }
 
-static int demangle_protection(char *buffer, char *start, char *prot, char *func) {
+/* The demangler appends through a tracked write cursor rather than
+ * strcat(), which would rescan the whole buffer on every append. */
+struct demangle_buf {
+    char *start;
+    char *cur;
+};
+
+/* a slice of already-written text, used for back-references */
+struct demangle_ref {
+    const char *str;
+    size_t len;
+};
+
+static void append_mem(struct demangle_buf *buf, const char *str, size_t len) {
+    memcpy(buf->cur, str, len);
+    buf->cur += len;
+}
+
+static void append_str(struct demangle_buf *buf, const char *str) {
+    append_mem(buf, str, strlen(str));
+}
+
+static int demangle_protection(struct demangle_buf *buf, char *start, char *prot, char *func) {
     if (*start >= 'A' && *start <= 'V') {
         if ((*start-'A') & 2)
-            strcat(buffer, "static ");
+            append_str(buf, "static ");
         if ((*start-'A') & 4)
-            strcat(buffer, "virtual ");
+            append_str(buf, "virtual ");
         if (!((*start-'A') & 1))
-            strcat(buffer, "near ");
+            append_str(buf, "near ");
         if (((*start-'A') & 24) == 0)
-            strcat(buffer, "private ");
+            append_str(buf, "private ");
         else if (((*start-'A') & 24) == 8)
-            strcat(buffer, "protected ");
+            append_str(buf, "protected ");
         else if (((*start-'A') & 24) == 16)
-            strcat(buffer, "public ");
+            append_str(buf, "public ");
         *prot = *start;
     } else if (*start == 'Y') {
-        strcat(buffer, "near ");
+        append_str(buf, "near ");
     } else if (*start == 'Z') {
         /* normally we'd mark far and not near, but most functions which
          * are going to have an exported name will be far. */
@@ -171,8 +196,8 @@ static int demangle_protection(char *buffer, char *start, char *prot, char *func
          * followed by either a number, or a string of text and then @. */
         *prot = 'V'; /* just pretend that for now */
         if (start[1] >= '0' && start[1] <= '9') {
-            strcat(buffer, "(X0) ");
-            buffer[strlen(buffer)-3] = start[1];
+            append_str(buf, "(X0) ");
+            buf->cur[-3] = start[1];
             return 2;
         } else {
             return (strchr(start, '@')+1)-start;
@@ -182,11 +207,11 @@ static int demangle_protection(char *buffer, char *start, char *prot, char *func
         /* Same as above, but there is an extra character first (which
          * is often V, so is likely to be the protection/etc), and then
          * a number (often 7 or 3). */
-        demangle_protection(buffer, start+1, prot, func);
+        demangle_protection(buf, start+1, prot, func);
         if (start[3] >= '0' && start[3] <= '9') {
-            strcat(buffer, "(_00) ");
-            buffer[strlen(buffer)-4] = start[2];
-            buffer[strlen(buffer)-3] = start[3];
+            append_str(buf, "(_00) ");
+            buf->cur[-4] = start[2];
+            buf->cur[-3] = start[3];
             return 4;
         } else {
             return (strchr(start, '@')+1)-start;
@@ -214,10 +239,10 @@ static const char *int_types[] = {
 };
 
 /* Returns the number of characters processed. */
-static int demangle_type(char **known_names, char *buffer, char *type) {
+static int demangle_type(struct demangle_ref *known_names, struct demangle_buf *buf, char *type) {
     if (*type >= 'C' && *type <= 'K') {
-        strcat(buffer, int_types[*type-'C']);
-        strcat(buffer, " ");
+        append_str(buf, int_types[*type-'C']);
+        append_str(buf, " ");
         return 1;
     }
 
@@ -227,27 +252,27 @@ static int demangle_type(char **known_names, char *buffer, char *type) {
     {
         int ret;
         if ((type[1]-'A') & 1)
-            strcat(buffer, "const ");
+            append_str(buf, "const ");
         if ((type[1]-'A') & 2)
-            strcat(buffer, "volatile ");
-        ret = demangle_type(known_names, buffer, type+2);
+            append_str(buf, "volatile ");
+        ret = demangle_type(known_names, buf, type+2);
         if (!((type[1]-'A') & 4))
-            strcat(buffer, "near ");
-        strcat(buffer, (*type == 'A') ? "&" : "*");
+            append_str(buf, "near ");
+        append_str(buf, (*type == 'A') ? "&" : "*");
         return ret+2;
     }
-    case 'M': strcat(buffer, "float "); return 1;
-    case 'N': strcat(buffer, "double "); return 1;
+    case 'M': append_str(buf, "float "); return 1;
+    case 'N': append_str(buf, "double "); return 1;
     case 'U':
     case 'V':
     {
-        const char *p = buffer, *end;
+        const char *end;
         unsigned int i;
 
         if (type[1] >= '0' && type[1] <= '9')
         {
-            strcat(buffer, known_names[type[1] - '0']);
-            strcat(buffer, " ");
+            append_mem(buf, known_names[type[1] - '0'].str, known_names[type[1] - '0'].len);
+            append_str(buf, " ");
             return 3;
         }
 
@@ -256,20 +281,21 @@ static int demangle_type(char **known_names, char *buffer, char *type) {
         /* something can go between the at signs, but what does it mean? */
         end = strchr(strchr(type, '@')+1, '@');
         if (end[-1] == '@')
-            strncat(buffer, type+1, (end-1)-(type+1));
+            append_mem(buf, type+1, (end-1)-(type+1));
         else
-            strncat(buffer, type+1, end-(type+1));
+            append_mem(buf, type+1, end-(type+1));
 
         for (i = 0; i < 10; ++i) {
-            if (!known_names[i]) {
-                known_names[i] = strdup(p);
+            if (!known_names[i].str) {
+                known_names[i].str = buf->start;
+                known_names[i].len = buf->cur - buf->start;
                 break;
             }
         }
-        strcat(buffer, " ");
+        append_str(buf, " ");
         return (end+1)-type;
     }
-    case 'X': strcat(buffer, "void "); return 1;
+    case 'X': append_str(buf, "void "); return 1;
     default: return 0;
     }
 }
@@ -277,28 +303,35 @@ static int demangle_type(char **known_names, char *buffer, char *type) {
 /* Demangle a C++ function name. The scheme used seems to be mostly older
  * than any documented, but I was able to find documentation that is at
  * least close in Agner Fog's manual. */
-static char *demangle(char *func) {
-    char *known_types[10] = {}, *known_names[10] = {};
+static char *demangle_uncached(char *func) {
+    struct demangle_ref known_types[10] = {}, known_names[10] = {};
     unsigned int known_type_idx = 0, known_name_idx = 0;
     char buffer[1024];
+    struct demangle_buf buf = {buffer, buffer};
     char *p, *start, *end;
+    char *ret;
     char prot = 0;
     int len;
 
+    PERF_COUNT(demangles);
+
     if (func[1] == '?')
     {
         /* TODO: constructor/destructor */
         return func;
     }
 
-    /* First populate the known names up to the function name. */
-    for (p = func; *p != '@' && known_name_idx < 10; p = strchr(p, '@') + 1)
-        known_names[known_name_idx++] = strndup(p, strchr(p, '@') - p);
+    /* First populate the known names up to the function name. These point
+     * straight into the mangled name; nothing needs to be duplicated. */
+    for (p = func; *p != '@' && known_name_idx < 10; p = strchr(p, '@') + 1) {
+        known_names[known_name_idx].str = p;
+        known_names[known_name_idx].len = strchr(p, '@') - p;
+        known_name_idx++;
+    }
 
     /* Figure out the modifiers and calling convention. */
-    buffer[0] = 0;
     p = strstr(func, "@@") + 2;
-    len = demangle_protection(buffer, p, &prot, func);
+    len = demangle_protection(&buf, p, &prot, func);
     if (!len) {
         return func;
     }
@@ -313,13 +346,13 @@ static char *demangle(char *func) {
 
     /* This should mark the calling convention. Always seems to be A,
      * but this corroborates the function body which uses CDECL. */
-    if (*p == 'A'); /* strcat(buffer, "__cdecl "); */
-    else if (*p == 'C') strcat(buffer, "__pascal ");
+    if (*p == 'A'); /* append_str(&buf, "__cdecl "); */
+    else if (*p == 'C') append_str(&buf, "__pascal ");
     else warn("Unknown calling convention %c for function %s\n", *p, func);
 
     /* This marks the return value. */
     p++;
-    len = demangle_type(known_names, buffer, p);
+    len = demangle_type(known_names, &buf, p);
     if (!len) {
         warn("Unknown return type %c for function %s\n", *p, func);
         len = 1;
@@ -332,48 +365,108 @@ static char *demangle(char *func) {
     while (1) {
         start--;
         while (*start != '?' && *start != '@') start--;
-        strncat(buffer, start+1, end-(start+1));
+        append_mem(&buf, start+1, end-(start+1));
         if (*start == '?') break;
-        strcat(buffer, "::");
+        append_str(&buf, "::");
         end = start;
     }
 
     /* Print the arguments. */
     if (*p == 'X') {
-        strcat(buffer, "(void)");
+        append_str(&buf, "(void)");
     } else {
-        strcat(buffer, "(");
+        append_str(&buf, "(");
         while (*p != '@') {
             if (*p >= '0' && *p <= '9') {
-                strcat(buffer, known_types[*p - '0']);
+                append_mem(&buf, known_types[*p - '0'].str, known_types[*p - '0'].len);
                 p++;
             } else {
-                const char *type = buffer + strlen(buffer);
-                len = demangle_type(known_names, buffer, p);
-                if (buffer[strlen(buffer)-1] == ' ')
-                    buffer[strlen(buffer)-1] = 0;
-                if (len > 1 && known_type_idx < 10)
-                    known_types[known_type_idx++] = strdup(type);
-                else if (!len) {
+                const char *type = buf.cur;
+                len = demangle_type(known_names, &buf, p);
+                if (buf.cur[-1] == ' ')
+                    buf.cur--;
+                if (len > 1 && known_type_idx < 10) {
+                    known_types[known_type_idx].str = type;
+                    known_types[known_type_idx].len = buf.cur - type;
+                    known_type_idx++;
+                } else if (!len) {
                     warn("Unknown argument type %c for function %s\n", *p, func);
                     len = 1;
                 }
                 p += len;
             }
-            strcat(buffer, ", ");
+            append_str(&buf, ", ");
         }
-        buffer[strlen(buffer)-2] = ')';
-        buffer[strlen(buffer)-1] = 0;
+        buf.cur[-2] = ')';
+        buf.cur--;
+    }
+
+    ret = arena_alloc(buf.cur - buffer + 1);
+    memcpy(ret, buffer, buf.cur - buffer);
+    ret[buf.cur - buffer] = 0;
+    return ret;
+}
+
+/* Run-wide demangling memoization. A batch run sees the same runtime
+ * exports in file after file; each distinct mangled name is demangled once
+ * and every later file gets the cached result. The cache lives in malloc
+ * rather than the arena because the arena is reset between files. */
+struct demangle_memo {
+    char *mangled;
+    char *demangled;
+};
+
+static struct demangle_memo *memo_table;
+static unsigned memo_count, memo_alloc;
+
+static unsigned long memo_hash(const char *str) {
+    unsigned long hash = 0xcbf29ce484222325ul;
+    while (*str) {
+        hash ^= (byte)*str++;
+        hash *= 0x100000001b3ul;
     }
+    return hash;
+}
+
+static struct demangle_memo *memo_probe(struct demangle_memo *table, unsigned alloc, const char *func) {
+    unsigned i = (unsigned)memo_hash(func) & (alloc - 1);
 
-    func = realloc(func, (strlen(buffer)+1)*sizeof(char));
-    strcpy(func, buffer);
+    while (table[i].mangled && strcmp(table[i].mangled, func))
+        i = (i + 1) & (alloc - 1);
+    return &table[i];
+}
 
-    while (known_type_idx)
-        free(known_types[--known_type_idx]);
-    while (known_name_idx)
-        free(known_names[--known_name_idx]);
-    return func;
+static struct demangle_memo *memo_slot(const char *func) {
+    unsigned i;
+
+    if (memo_count * 4 >= memo_alloc * 3) {
+        struct demangle_memo *old = memo_table;
+        unsigned old_alloc = memo_alloc;
+
+        memo_alloc = memo_alloc ? memo_alloc * 2 : 1024;
+        memo_table = calloc(memo_alloc, sizeof(*memo_table));
+        for (i = 0; i < old_alloc; i++)
+            if (old[i].mangled)
+                *memo_probe(memo_table, memo_alloc, old[i].mangled) = old[i];
+        free(old);
+    }
+
+    return memo_probe(memo_table, memo_alloc, func);
+}
+
+static char *demangle(char *func) {
+    struct demangle_memo *m = memo_slot(func);
+    char *ret;
+
+    if (m->mangled)
+        return m->demangled;
+
+    ret = demangle_uncached(func);
+    m->mangled = strdup(func);
+    /* a failed demangle returns the input; cache our own copy of it */
+    m->demangled = (ret == func) ? m->mangled : strdup(ret);
+    memo_count++;
+    return m->demangled;
 }
 
 /* return the first entry (module name/desc) */
@@ -386,14 +479,22 @@ static char *read_res_name_table(off_t start, struct entry *entry_table)
     char *name;
 
     length = read_byte(cursor++);
-    first = malloc((length+1)*sizeof(char));
+    first = arena_alloc((length+1)*sizeof(char));
     memcpy(first, read_data(cursor), length);
     first[length] = 0;
     cursor += length + 2;
 
     while ((length = read_byte(cursor++)))
     {
-        name = malloc((length+1)*sizeof(char));
+        /* header-only dumps don't read the entry table, so there is
+         * nowhere to put the names either */
+        if (!entry_table)
+        {
+            cursor += length + 2;
+            continue;
+        }
+
+        name = arena_alloc((length+1)*sizeof(char));
         memcpy(name, read_data(cursor), length);
         name[length] = 0;
         cursor += length;
@@ -408,6 +509,30 @@ static char *read_res_name_table(off_t start, struct entry *entry_table)
     return first;
 }
 
+static int entry_index_cmp(const void *a, const void *b) {
+    const struct entry_index *ea = a, *eb = b;
+    if (ea->segment != eb->segment)
+        return (int)ea->segment - (int)eb->segment;
+    if (ea->offset != eb->offset)
+        return (int)ea->offset - (int)eb->offset;
+    /* keep table order for duplicate addresses */
+    return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+/* Build a (segment:offset -> entry) index so that get_entry_name() can
+ * resolve an address in logarithmic time. */
+static void build_entry_index(struct ne *ne) {
+    unsigned i;
+
+    ne->entidx = arena_alloc(ne->entcount * sizeof(struct entry_index));
+    for (i = 0; i < ne->entcount; i++) {
+        ne->entidx[i].segment = ne->enttab[i].segment;
+        ne->entidx[i].offset = ne->enttab[i].offset;
+        ne->entidx[i].index = i;
+    }
+    qsort(ne->entidx, ne->entcount, sizeof(struct entry_index), entry_index_cmp);
+}
+
 static void get_entry_table(off_t start, struct ne *ne)
 {
     byte length, index;
@@ -425,7 +550,7 @@ static void get_entry_table(off_t start, struct ne *ne)
         if (index != 0)
             cursor += (index == 0xff ? 6 : 3) * length;
     }
-    ne->enttab = calloc(sizeof(struct entry), count);
+    ne->enttab = arena_calloc(count, sizeof(struct entry));
 
     count = 0;
     cursor = start;
@@ -454,15 +579,159 @@ static void get_entry_table(off_t start, struct ne *ne)
     }
 
     ne->entcount = count;
+    build_entry_index(ne);
+}
+
+/* Compiled specfile cache. Parsing the text specfiles dominates startup
+ * when dumping many files, so the parsed (sorted) export list is saved
+ * next to the specfile as MODULE.ORC and reused as long as the specfile's
+ * size and mtime still match. */
+
+#pragma pack(1)
+
+struct spec_cache_header {
+    char magic[4];      /* "ORC1" */
+    dword count;        /* number of exports */
+    dword pool_len;     /* length of the name pool */
+    dword src_size;     /* size of the source specfile */
+    dword src_mtime;    /* mtime of the source specfile */
+};
+
+struct spec_cache_export {
+    word ordinal;
+    dword name;         /* offset into the name pool; 0 = no name */
+};
+
+#pragma pack()
+
+static int read_spec_cache(const char *cache_name, const struct stat *st,
+    struct import_module *module) {
+    struct spec_cache_header header;
+    struct spec_cache_export *entries = NULL;
+    char *pool = NULL;
+    struct stat cachest;
+    FILE *cachefile;
+    unsigned i;
+
+    if (!(cachefile = fopen(cache_name, "rb")))
+        return 0;
+
+    if (fread(&header, sizeof(header), 1, cachefile) != 1
+        || memcmp(header.magic, "ORC1", 4)
+        || header.src_size != (dword)st->st_size
+        || header.src_mtime != (dword)st->st_mtime)
+        goto fail;
+
+    /* Don't trust the header's sizes: a truncated or corrupted cache has
+     * to fall back to the text parser like any other mismatch, not feed
+     * garbage counts to malloc(). The writer emits exactly a header, the
+     * entries, and the name pool (never empty; it starts with a NUL). */
+    if (fstat(fileno(cachefile), &cachest) < 0
+        || !header.pool_len
+        || (qword)cachest.st_size != sizeof(header)
+            + (qword)header.count * sizeof(*entries) + header.pool_len)
+        goto fail;
+
+    entries = malloc(header.count * sizeof(*entries));
+    pool = malloc(header.pool_len);
+    if (fread(entries, sizeof(*entries), header.count, cachefile) != header.count
+        || fread(pool, 1, header.pool_len, cachefile) != header.pool_len)
+        goto fail;
+
+    /* every name must be terminated inside the pool */
+    if (pool[header.pool_len - 1])
+        goto fail;
+
+    module->exports = arena_alloc(header.count * sizeof(struct export));
+    for (i = 0; i < header.count; i++) {
+        if (entries[i].name >= header.pool_len)
+            goto fail;
+        module->exports[i].ordinal = entries[i].ordinal;
+        module->exports[i].name = entries[i].name ? arena_strdup(&pool[entries[i].name]) : NULL;
+    }
+    module->export_count = header.count;
+
+    free(entries);
+    free(pool);
+    fclose(cachefile);
+    return 1;
+
+fail:
+    free(entries);
+    free(pool);
+    module->exports = NULL;
+    fclose(cachefile);
+    return 0;
+}
+
+static void write_spec_cache(const char *cache_name, const struct stat *st,
+    const struct import_module *module) {
+    struct spec_cache_header header;
+    struct spec_cache_export entry;
+    FILE *cachefile;
+    dword pool_len = 1;     /* leading NUL so that offset 0 can mean "no name" */
+    unsigned i;
+
+    /* failure just means we parse the specfile again next run */
+    if (!(cachefile = fopen(cache_name, "wb")))
+        return;
+
+    for (i = 0; i < module->export_count; i++) {
+        if (module->exports[i].name)
+            pool_len += strlen(module->exports[i].name) + 1;
+    }
+
+    memcpy(header.magic, "ORC1", 4);
+    header.count = module->export_count;
+    header.pool_len = pool_len;
+    header.src_size = st->st_size;
+    header.src_mtime = st->st_mtime;
+    fwrite(&header, sizeof(header), 1, cachefile);
+
+    pool_len = 1;
+    for (i = 0; i < module->export_count; i++) {
+        entry.ordinal = module->exports[i].ordinal;
+        entry.name = module->exports[i].name ? pool_len : 0;
+        if (module->exports[i].name)
+            pool_len += strlen(module->exports[i].name) + 1;
+        fwrite(&entry, sizeof(entry), 1, cachefile);
+    }
+
+    fputc(0, cachefile);
+    for (i = 0; i < module->export_count; i++) {
+        if (module->exports[i].name)
+            fwrite(module->exports[i].name, strlen(module->exports[i].name) + 1, 1, cachefile);
+    }
+
+    fclose(cachefile);
+}
+
+/* Sort exports by ordinal so get_imported_name() can binary-search them.
+ * Insertion sort: specfiles are almost always ordered already, and being
+ * stable preserves first-entry-wins for duplicate ordinals. */
+static void sort_exports(struct export *exports, unsigned count) {
+    unsigned i, j;
+
+    for (i = 1; i < count; i++) {
+        struct export e = exports[i];
+        for (j = i; j > 0 && exports[j-1].ordinal > e.ordinal; j--)
+            exports[j] = exports[j-1];
+        exports[j] = e;
+    }
 }
 
 static void load_exports(struct import_module *module) {
     FILE *specfile;
-    char spec_name[18];
+    struct stat st;
+    char spec_name[18], cache_name[18];
     char line[300], *p;
     int count;
+    int cached = 0;
     word ordinal;
 
+    module->exports = NULL;
+    module->export_count = 0;
+
     sprintf(spec_name, "%.8s.ORD", module->name);
     specfile = fopen(spec_name, "r");
     if (!specfile) {
@@ -471,48 +740,64 @@ static void load_exports(struct import_module *module) {
         if (!specfile) {
             fprintf(stderr, "Note: couldn't find specfile for module %s; exported names won't be given.\n", module->name);
             fprintf(stderr, "      To create a specfile, run `dumpne -o <module.dll>'.\n");
-            module->exports = NULL;
-            module->export_count = 0;
             return;
         }
     }
 
-    /* first grab a count */
-    count = 0;
-    while (fgets(line, sizeof(line), specfile)) {
-        if (line[0] == '#' || line[0] == '\n') continue;
-        count++;
-    }
+    strcpy(cache_name, spec_name);
+    strcpy(cache_name + strlen(cache_name) - 3, "ORC");
 
-    module->exports = malloc(count * sizeof(struct export));
+    if (fstat(fileno(specfile), &st) < 0)
+        st.st_size = st.st_mtime = 0;
+    else
+        cached = read_spec_cache(cache_name, &st, module);
 
-    fseek(specfile, 0, SEEK_SET);
-    count = 0;
-    while (fgets(line, sizeof(line), specfile)) {
-        if (line[0] == '#' || line[0] == '\n') continue;
-        if ((p = strchr(line, '\n'))) *p = 0;   /* kill final newline */
-        if (sscanf(line, "%hu", &ordinal) != 1) {
-            fprintf(stderr, "Error reading specfile near line: `%s'\n", line);
-            continue;
+    if (!cached) {
+        /* first grab a count */
+        count = 0;
+        while (fgets(line, sizeof(line), specfile)) {
+            if (line[0] == '#' || line[0] == '\n') continue;
+            count++;
         }
-        module->exports[count].ordinal = ordinal;
 
-        p = strchr(line, '\t');
-        if (p) {
-            p++;
-            module->exports[count].name = strdup(p);
-    
-            if ((opts & DEMANGLE) && module->exports[count].name[0] == '?')
-                module->exports[count].name = demangle(module->exports[count].name);
-        } else {
-            module->exports[count].name = NULL;
+        module->exports = arena_alloc(count * sizeof(struct export));
+
+        fseek(specfile, 0, SEEK_SET);
+        count = 0;
+        while (fgets(line, sizeof(line), specfile)) {
+            if (line[0] == '#' || line[0] == '\n') continue;
+            if ((p = strchr(line, '\n'))) *p = 0;   /* kill final newline */
+            if (sscanf(line, "%hu", &ordinal) != 1) {
+                fprintf(stderr, "Error reading specfile near line: `%s'\n", line);
+                continue;
+            }
+            module->exports[count].ordinal = ordinal;
+
+            p = strchr(line, '\t');
+            if (p) {
+                p++;
+                module->exports[count].name = arena_strdup(p);
+            } else {
+                module->exports[count].name = NULL;
+            }
+            count++;
         }
-        count++;
-    }
 
-    module->export_count = count;
+        module->export_count = count;
+
+        sort_exports(module->exports, module->export_count);
+        write_spec_cache(cache_name, &st, module);
+    }
 
     fclose(specfile);
+
+    if (opts & DEMANGLE) {
+        unsigned i;
+        for (i = 0; i < module->export_count; i++) {
+            if (module->exports[i].name && module->exports[i].name[0] == '?')
+                module->exports[i].name = demangle(module->exports[i].name);
+        }
+    }
 }
 
 static void get_import_module_table(off_t start, struct ne *ne)
@@ -521,17 +806,19 @@ static void get_import_module_table(off_t start, struct ne *ne)
     byte length;
     unsigned i;
 
-    ne->imptab = malloc(ne->header.ne_cmod * sizeof(struct import_module));
+    ne->imptab = arena_alloc(ne->header.ne_cmod * sizeof(struct import_module));
     for (i = 0; i < ne->header.ne_cmod; i++) {
         offset = read_word(start + i * 2);
         length = ne->nametab[offset];
-        ne->imptab[i].name = malloc((length+1)*sizeof(char));
+        ne->imptab[i].name = arena_alloc((length+1)*sizeof(char));
         memcpy(ne->imptab[i].name, &ne->nametab[offset+1], length);
         ne->imptab[i].name[length] = 0;
 
-        if (mode & DISASSEMBLE)
+        if (mode & DISASSEMBLE) {
+            perf_enter(PERF_RESOLVE);
             load_exports(&ne->imptab[i]);
-        else {
+            perf_leave(PERF_RESOLVE);
+        } else {
             ne->imptab[i].exports = NULL;
             ne->imptab[i].export_count = 0;
         }
@@ -541,51 +828,78 @@ static void get_import_module_table(off_t start, struct ne *ne)
 void readne(off_t offset_ne, struct ne *ne) {
     memcpy(&ne->header, read_data(offset_ne), sizeof(ne->header));
 
-    /* read our various tables */
-    get_entry_table(offset_ne + ne->header.ne_enttab, ne);
+    /* read our various tables, but only the ones this run will actually
+     * look at—a header-only dump of a large corpus shouldn't page in
+     * every segment and spec file */
+    if (mode & (DUMPEXPORT | SPECFILE | DISASSEMBLE))
+        get_entry_table(offset_ne + ne->header.ne_enttab, ne);
+
+    /* the name tables provide the module name and description, which we
+     * print for every mode */
     ne->name = read_res_name_table(offset_ne + ne->header.ne_restab, ne->enttab);
     ne->description = read_res_name_table(ne->header.ne_nrestab, ne->enttab);
-    ne->nametab = read_data(offset_ne + ne->header.ne_imptab);
-    get_import_module_table(offset_ne + ne->header.ne_modtab, ne);
-    read_segments(offset_ne + ne->header.ne_segtab, ne);
+
+    if (mode & (DUMPIMPORT | DISASSEMBLE))
+    {
+        ne->nametab = read_data(offset_ne + ne->header.ne_imptab);
+        get_import_module_table(offset_ne + ne->header.ne_modtab, ne);
+    }
+
+    if (mode & DISASSEMBLE)
+        read_segments(offset_ne + ne->header.ne_segtab, ne);
 }
 
-void freene(struct ne *ne) {
-    int i, j;
+/* Emit the same information as the pretty printers, but as tab-separated
+ * records that scripts can split without a regex for every line. */
+static void print_structured(struct ne *ne)
+{
+    int i;
 
-    free(ne->name);
-    free(ne->description);
+    printf("module\tne\t%s\t%s\n", ne->name, ne->description);
+
+    if (mode & DUMPHEADER) {
+        struct header_ne *header = &ne->header;
+        printf("header\tlinker_version\t%d.%d\n", header->ne_ver, header->ne_rev);
+        printf("header\tchecksum\t%08x\n", header->ne_crc);
+        printf("header\tflags\t%04x\n", header->ne_flags);
+        printf("header\tautodata\t%d\n", header->ne_autodata);
+        printf("header\theap\t%d\n", header->ne_heap);
+        printf("header\tstack\t%d\n", header->ne_stack);
+        printf("header\tentry_point\t%d:%04x\n", header->ne_cs, header->ne_ip);
+        printf("header\tstack_location\t%d:%04x\n", header->ne_ss, header->ne_sp);
+        printf("header\ttarget_os\t%d\n", header->ne_exetyp);
+        printf("header\tflags_others\t%02x\n", header->ne_flagsothers);
+        printf("header\tswap_area\t%d\n", header->ne_swaparea);
+        printf("header\texpected_version\t%d.%d\n",
+            header->ne_expver_maj, header->ne_expver_min);
+    }
 
-    /* free the entry table */
-    if (ne->enttab) {
+    if (mode & DUMPEXPORT) {
         for (i = 0; i < ne->entcount; i++)
-            free(ne->enttab[i].name);
-        free(ne->enttab);
+            if (ne->enttab[i].segment)
+                printf("export\t%d\t%d:%04x\t%s\n", i+1, ne->enttab[i].segment,
+                    ne->enttab[i].offset, ne->enttab[i].name ? ne->enttab[i].name : "");
     }
 
-    /* free the import module table */
-    if (ne->imptab) {
-        for (i = 0; i < ne->header.ne_cmod; i++) {
-            free(ne->imptab[i].name);
-            for (j = 0; j < ne->imptab[i].export_count; j++)
-                free(ne->imptab[i].exports[j].name);
-            free(ne->imptab[i].exports);
-        }
-        free(ne->imptab);
+    if (mode & DUMPIMPORT) {
+        for (i = 0; i < ne->header.ne_cmod; i++)
+            printf("import\t%s\n", ne->imptab[i].name);
     }
-
-    free_segments(ne);
 }
 
 void dumpne(long offset_ne) {
-    struct ne ne;
+    struct ne ne = {0};
     int i;
 
     readne(offset_ne, &ne);
 
     if (mode == SPECFILE) {
         print_specfile(&ne);
-        freene(&ne);
+        return;
+    }
+
+    if (opts & STRUCTURED) {
+        print_structured(&ne);
         return;
     }
 
@@ -609,15 +923,16 @@ void dumpne(long offset_ne) {
             printf("\t%s\n", ne.imptab[i].name);
     }
 
-    if (mode & DISASSEMBLE)
+    if (mode & DISASSEMBLE) {
+        perf_enter(PERF_FORMAT);
         print_segments(&ne);
+        perf_leave(PERF_FORMAT);
+    }
 
-    if (mode & DUMPRSRC){
+    if (mode & (DUMPRSRC | EXTRACT_RSRC)){
         if (ne.header.ne_rsrctab != ne.header.ne_restab)
             print_rsrc(offset_ne + ne.header.ne_rsrctab);
         else
             printf("No resource table\n");
     }
-
-    freene(&ne);
 }
@@ -24,9 +24,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "semblance.h"
 #include "ne.h"
+#include "output.h"
 
 #pragma pack(1)
 
@@ -57,50 +60,21 @@ static char *dup_string_resource(off_t offset)
 
 /* length-indexed; returns  */
 static void print_escaped_string(off_t offset, long length){
-    putchar('"');
-    while (length--){
-        char c = read_byte(offset++);
-        if (c == '\t')
-            printf("\\t");
-        else if (c == '\n')
-            printf("\\n");
-        else if (c == '\r')
-            printf("\\r");
-        else if (c == '"')
-            printf("\\\"");
-        else if (c == '\\')
-            printf("\\\\");
-        else if (c >= ' ' && c <= '~')
-            putchar(c);
-        else
-            printf("\\x%02hhx", c);
-    }
-    putchar('"');
+    out_char('"');
+    out_escaped(read_data(offset), length);
+    out_char('"');
+    out_flush();
 }
 
 /* null-terminated; returns the end of the string */
 static off_t print_escaped_string0(off_t offset)
 {
-    char c;
-    putchar('"');
-    while ((c = read_byte(offset++))){
-        if (c == '\t')
-            printf("\\t");
-        else if (c == '\n')
-            printf("\\n");
-        else if (c == '\r')
-            printf("\\r");
-        else if (c == '"')
-            printf("\\\"");
-        else if (c == '\\')
-            printf("\\\\");
-        else if (c >= ' ' && c <= '~')
-            putchar(c);
-        else
-            printf("\\x%02hhx", c);
-    }
-    putchar('"');
-    return offset;
+    size_t length = strlen(read_data(offset));
+    out_char('"');
+    out_escaped(read_data(offset), length);
+    out_char('"');
+    out_flush();
+    return offset + length + 1;
 }
 
 static void print_timestamp(dword high, dword low){
@@ -1039,6 +1013,30 @@ static int filter_resource(const char *type, const char *id){
     return 0;
 }
 
+/* Write the raw resource payload to a file, straight from the mapping. */
+static void extract_resource(const char *type, const char *id, off_t offset, size_t length)
+{
+    char filename[1024];
+    FILE *f;
+    unsigned i;
+
+    snprintf(filename, sizeof(filename), "%s.%s.%s.res", extract_basename, type, id);
+
+    /* resource types and IDs can be arbitrary strings; keep the name sane */
+    for (i = 0; filename[i]; ++i) {
+        if (filename[i] == '/' || filename[i] == ' ' || filename[i] == '"')
+            filename[i] = '_';
+    }
+
+    if (!(f = fopen(filename, "wb"))) {
+        warn("Couldn't open %s.\n", filename);
+        return;
+    }
+    if (fwrite(read_data(offset), 1, length, f) != length)
+        warn("Failed to write %s.\n", filename);
+    fclose(f);
+}
+
 struct resource {
     word offset;
     word length;
@@ -1058,14 +1056,109 @@ struct type_header
     struct resource resources[1];
 };
 
+/* One resource that survived filter_resource(). The type name is re-derived
+ * from type_id/typedup on use rather than stored, since numeric names live
+ * in a caller-provided buffer and the entry array moves when it grows. */
+struct rsrc_entry {
+    word type_id;
+    word id;
+    word flags;
+    dword offset;   /* already shifted by the alignment */
+    dword length;
+    char *typedup;  /* string type name, or NULL for a numeric type */
+    char *idstr;
+};
+
+static const char *rsrc_type_name(word type_id, const char *typedup, char numstr[7])
+{
+    if (!(type_id & 0x8000))
+        return typedup;
+
+    if ((type_id & (~0x8000)) < rsrc_types_count && rsrc_types[type_id & (~0x8000)])
+        return rsrc_types[type_id & ~0x8000];
+
+    sprintf(numstr, "0x%04x", type_id);
+    return numstr;
+}
+
+static void print_rsrc_entry(const struct rsrc_entry *e)
+{
+    char numstr[7];
+    const char *type = rsrc_type_name(e->type_id, e->typedup, numstr);
+
+    if (e->typedup)
+        printf("\n\"%s\"", type);
+    else
+        printf("\n%s", type);
+
+    printf(" %s", e->idstr);
+    printf(" (offset = 0x%x, length = %d [0x%x]", e->offset, e->length, e->length);
+    print_rsrc_flags(e->flags);
+    printf("):\n");
+
+    print_rsrc_resource(e->type_id, e->offset, e->length, e->id);
+}
+
+/* Same trick as print_sections_parallel() on the PE side: formatting an
+ * entry only reads the mapping, so fork a worker per resource, each writing
+ * to an unlinked temporary file, and copy the files to stdout in table
+ * order. Workers share stderr, so warnings may interleave. */
+static void print_rsrc_parallel(const struct rsrc_entry *entries, unsigned count)
+{
+    pid_t *pids = malloc(count * sizeof(*pids));
+    FILE **tmps = malloc(count * sizeof(*tmps));
+    char buf[8192];
+    size_t len;
+    unsigned started = 0, done = 0;
+
+    /* make sure buffered output doesn't end up in the workers too */
+    fflush(stdout);
+
+    while (done < count) {
+        while (started < count && started - done < (unsigned)dump_jobs) {
+            pid_t pid;
+
+            if (!(tmps[started] = tmpfile())) {
+                perror("Cannot create temporary file");
+                exit(1);
+            }
+
+            if ((pid = fork()) < 0) {
+                perror("Cannot fork");
+                exit(1);
+            } else if (pid == 0) {
+                dup2(fileno(tmps[started]), STDOUT_FILENO);
+                print_rsrc_entry(&entries[started]);
+                fflush(stdout);
+                _exit(0);
+            }
+            pids[started++] = pid;
+        }
+
+        waitpid(pids[done], NULL, 0);
+        rewind(tmps[done]);
+        while ((len = fread(buf, 1, sizeof(buf), tmps[done])) > 0)
+            fwrite(buf, 1, len, stdout);
+        fclose(tmps[done]);
+        done++;
+    }
+
+    free(pids);
+    free(tmps);
+}
+
 void print_rsrc(off_t start){
     const struct type_header *header;
     word align = read_word(start);
+    struct rsrc_entry *entries = NULL;
+    unsigned count = 0, alloc = 0, j;
     char *idstr;
     word i;
 
     header = read_data(start + sizeof(word));
 
+    /* First pass: walk the resource table once and index everything that
+     * passes the filters. Extraction and dumping both work from the index. */
     while (header->type_id)
     {
         if (header->resloader)
@@ -1074,6 +1167,10 @@ void print_rsrc(off_t start){
         for (i = 0; i < header->count; ++i)
         {
             const struct resource *rn = &header->resources[i];
+            char numstr[7];
+            char *typedup = NULL;
+            const char *type;
+            struct rsrc_entry *e;
 
             if (rn->id & 0x8000){
                 idstr = malloc(6);
@@ -1081,43 +1178,55 @@ void print_rsrc(off_t start){
             } else
                 idstr = dup_string_resource(start + rn->id);
 
-            if (header->type_id & 0x8000)
-            {
-                if ((header->type_id & (~0x8000)) < rsrc_types_count && rsrc_types[header->type_id & (~0x8000)]){
-                    if (!filter_resource(rsrc_types[header->type_id & ~0x8000], idstr))
-                        goto next;
-                    printf("\n%s", rsrc_types[header->type_id & ~0x8000]);
-                } else {
-                    char typestr[7];
-                    sprintf(typestr, "0x%04x", header->type_id);
-                    if (!filter_resource(typestr, idstr))
-                        goto next;
-                    printf("\n%s", typestr);
-                }
+            if (!(header->type_id & 0x8000))
+                typedup = dup_string_resource(start + header->type_id);
+            type = rsrc_type_name(header->type_id, typedup, numstr);
+
+            if (!filter_resource(type, idstr)) {
+                free(typedup);
+                free(idstr);
+                continue;
             }
-            else
-            {
-                char *typestr = dup_string_resource(start + header->type_id);
-                if (!filter_resource(typestr, idstr))
-                {
-                    free(typestr);
-                    goto next;
-                }
-                printf("\n\"%s\"", typestr);
-                free(typestr);
+
+            if (count == alloc) {
+                alloc = alloc ? alloc * 2 : 64;
+                entries = realloc(entries, alloc * sizeof(*entries));
             }
+            e = &entries[count++];
+            e->type_id = header->type_id;
+            e->id = rn->id;
+            e->flags = rn->flags;
+            e->offset = rn->offset << align;
+            e->length = rn->length << align;
+            e->typedup = typedup;
+            e->idstr = idstr;
+        }
+
+        header = (struct type_header *)(&header->resources[header->count]);
+    }
 
-            printf(" %s", idstr);
-            printf(" (offset = 0x%x, length = %d [0x%x]", rn->offset << align, rn->length << align, rn->length << align);
-            print_rsrc_flags(rn->flags);
-            printf("):\n");
+    if (mode & EXTRACT_RSRC) {
+        for (j = 0; j < count; ++j) {
+            char numstr[7];
+            const struct rsrc_entry *e = &entries[j];
 
-            print_rsrc_resource(header->type_id, rn->offset << align, rn->length << align, rn->id);
+            extract_resource(rsrc_type_name(e->type_id, e->typedup, numstr),
+                e->idstr, e->offset, e->length);
+        }
+    }
 
-next:
-            free(idstr);
+    if (mode & DUMPRSRC) {
+        if (dump_jobs > 1 && count > 1) {
+            print_rsrc_parallel(entries, count);
+        } else {
+            for (j = 0; j < count; ++j)
+                print_rsrc_entry(&entries[j]);
         }
+    }
 
-        header = (struct type_header *)(&header->resources[header->count]);
+    for (j = 0; j < count; ++j) {
+        free(entries[j].typedup);
+        free(entries[j].idstr);
     }
+    free(entries);
 }
@@ -25,9 +25,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "semblance.h"
 #include "ne.h"
+#include "output.h"
+#include "perf.h"
 #include "x86_instr.h"
+#include "x86_scan.h"
 
 #ifdef USE_WARN
 #define warn_at(...) \
@@ -39,33 +43,57 @@
 
 /* index function */
 static char *get_entry_name(word cs, word ip, const struct ne *ne) {
-    unsigned i;
-    for (i=0; i<ne->entcount; i++) {
-        if (ne->enttab[i].segment == cs &&
-            ne->enttab[i].offset == ip)
-            return ne->enttab[i].name;
+    unsigned lo = 0, hi = ne->entcount;
+
+    /* binary search over the sorted entry index */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (ne->entidx[mid].segment < cs ||
+            (ne->entidx[mid].segment == cs && ne->entidx[mid].offset < ip))
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < ne->entcount && ne->entidx[lo].segment == cs && ne->entidx[lo].offset == ip)
+        return ne->enttab[ne->entidx[lo].index].name;
     return NULL;
 }
 
 /* index function */
 static const struct reloc *get_reloc(const struct segment *seg, word ip) {
-    unsigned i, o;
-    for (i = 0; i < seg->reloc_count; i++) {
-        for (o = 0; o < seg->reloc_table[i].offset_count; o++)
-            if (seg->reloc_table[i].offsets[o] == ip)
-                return &seg->reloc_table[i];
+    unsigned lo = 0, hi = seg->reloc_offset_count;
+
+    PERF_COUNT(reloc_lookups);
+
+    /* binary search over the sorted offset index */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (seg->reloc_offsets[mid].offset < ip)
+            lo = mid + 1;
+        else if (seg->reloc_offsets[mid].offset > ip)
+            hi = mid;
+        else
+            return &seg->reloc_table[seg->reloc_offsets[mid].index];
     }
     return NULL;
 }
 
 /* load an imported name from a specfile */
 static char *get_imported_name(word module, word ordinal, const struct ne *ne) {
-    unsigned i;
-    for (i=0; i<ne->imptab[module-1].export_count; i++) {
-        if (ne->imptab[module-1].exports[i].ordinal == ordinal)
-            return ne->imptab[module-1].exports[i].name;
+    const struct import_module *mod = &ne->imptab[module-1];
+    unsigned lo = 0, hi = mod->export_count;
+
+    /* exports are sorted by ordinal (see load_exports); find the first
+     * entry in case a specfile lists an ordinal more than once */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (mod->exports[mid].ordinal < ordinal)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < mod->export_count && mod->exports[lo].ordinal == ordinal)
+        return mod->exports[lo].name;
     return NULL;
 }
 
@@ -124,43 +152,40 @@ static const char *relocate_arg(const struct segment *seg, struct arg *arg, cons
     return NULL;
 }
 
-/* Returns the number of bytes processed (same as get_instr). */
-static int print_ne_instr(const struct segment *seg, word ip, byte *p, const struct ne *ne) {
+/* Format one instruction already decoded by decode_block(). */
+static void print_ne_instr(const struct segment *seg, word ip, byte *p, int len,
+    struct instr *instr, const struct ne *ne) {
     word cs = seg->cs;
-    struct instr instr = {0};
-    unsigned len;
     int bits = (seg->flags & 0x2000) ? 32 : 16;
 
     const char *comment = NULL;
     char ip_string[11];
 
-    len = get_instr(ip, p, &instr, bits);
-
     sprintf(ip_string, "%3d:%04x", seg->cs, ip);
 
     /* check for relocations */
-    if (seg->instr_flags[instr.args[0].ip] & INSTR_RELOC)
-        comment = relocate_arg(seg, &instr.args[0], ne);
-    if (seg->instr_flags[instr.args[1].ip] & INSTR_RELOC)
-        comment = relocate_arg(seg, &instr.args[1], ne);
+    if (seg->instr_flags[instr->args[0].ip] & INSTR_RELOC)
+        comment = relocate_arg(seg, &instr->args[0], ne);
+    if (seg->instr_flags[instr->args[1].ip] & INSTR_RELOC)
+        comment = relocate_arg(seg, &instr->args[1], ne);
     /* make sure to check for PTR32 segment-only relocations */
-    if (instr.op.arg0 == PTR32 && seg->instr_flags[instr.args[0].ip+2] & INSTR_RELOC)
-        comment = relocate_arg(seg, &instr.args[0], ne);
+    if (instr->op.arg0 == PTR32 && seg->instr_flags[instr->args[0].ip+2] & INSTR_RELOC)
+        comment = relocate_arg(seg, &instr->args[0], ne);
 
     /* check if we are referencing a named export */
-    if (!comment && instr.op.arg0 == REL16)
-        comment = get_entry_name(cs, instr.args[0].value, ne);
-
-    print_instr(ip_string, p, len, seg->instr_flags[ip], &instr, comment, bits);
+    if (!comment && instr->op.arg0 == REL16)
+        comment = get_entry_name(cs, instr->args[0].value, ne);
 
-    return len;
+    print_instr(ip_string, p, len, seg->instr_flags[ip], instr, comment, bits);
 };
 
 static void print_disassembly(const struct segment *seg, const struct ne *ne) {
     const word cs = seg->cs;
+    const int bits = (seg->flags & 0x2000) ? 32 : 16;
     word ip = 0;
 
-    byte buffer[MAX_INSTR];
+    struct instr_block block;
+    unsigned i;
 
     while (ip < seg->length) {
         /* find a valid instruction */
@@ -169,34 +194,41 @@ static void print_disassembly(const struct segment *seg, const struct ne *ne) {
                 /* still skip zeroes */
                 if (read_byte(seg->start + ip) == 0)
                 {
-                    printf("     ...\n");
+                    out_str("     ...\n");
                     ip++;
                     while (read_byte(seg->start + ip) == 0) ip++;
                 }
             } else {
-                printf("     ...\n");
+                out_str("     ...\n");
                 while ((ip < seg->length) && !(seg->instr_flags[ip] & INSTR_VALID)) ip++;
             }
         }
 
-        if (ip >= seg->length) return;
+        if (ip >= seg->length) {
+            out_flush();
+            return;
+        }
 
-        /* Instructions can "hang over" the end of a segment.
-         * Zero should be supplied. */
-        memset(buffer, 0, sizeof(buffer));
-        memcpy(buffer, read_data(seg->start + ip), min(sizeof(buffer), seg->length - ip));
+        /* Decode a straight run of instructions, then format it. */
+        if (!decode_block(&block, seg->start, 0, ip, seg->length, seg->length,
+                seg->instr_flags, bits))
+            break;
 
-        if (seg->instr_flags[ip] & INSTR_FUNC) {
-            char *name = get_entry_name(cs, ip, ne);
-            printf("\n");
-            printf("%d:%04x <%s>:\n", cs, ip, name ? name : "no name");
-            /* don't mark far functions—we can't reliably detect them
-             * because of "push cs", and they should be evident anyway. */
+        for (i = 0; i < block.count; i++) {
+            if (seg->instr_flags[block.ip[i]] & INSTR_FUNC) {
+                char *name = get_entry_name(cs, block.ip[i], ne);
+                out_fmt("\n%d:%04x <%s>:\n", cs, block.ip[i], name ? name : "no name");
+                /* don't mark far functions—we can't reliably detect them
+                 * because of "push cs", and they should be evident anyway. */
+            }
+
+            print_ne_instr(seg, block.ip[i], block.bytes[i], block.len[i], &block.instr[i], ne);
         }
 
-        ip += print_ne_instr(seg, ip, buffer, ne);
+        ip = block.ip[block.count - 1] + block.len[block.count - 1];
     }
-    putchar('\n');
+    out_char('\n');
+    out_flush();
 }
 
 static void print_data(const struct segment *seg) {
@@ -204,108 +236,106 @@ static void print_data(const struct segment *seg) {
 
     for (ip = 0; ip < seg->length; ip += 16) {
         int len = min(seg->length-ip, 16);
-        int i;
 
-        printf("%3d:%04x", seg->cs, ip);
-        for (i=0; i<16; i++) {
-            if (i < len)
-                printf(" %02x", read_byte(seg->start + ip + i));
-            else
-                printf("   ");
-        }
-        printf("  ");
-        for (i = 0; i < len; ++i)
-        {
-            char c = read_byte(seg->start + ip + i);
-            putchar(isprint(c) ? c : '.');
-        }
-        putchar('\n');
+        out_fmt("%3d:%04x", seg->cs, ip);
+        out_hexdump_line(read_data(seg->start + ip), len);
     }
+    out_flush();
 }
 
-static void scan_segment(word cs, word ip, struct ne *ne) {
-    struct segment *seg = &ne->segments[cs-1];
+/* The segment the engine is currently scanning, for the callbacks below. */
+static struct segment *scan_seg;
 
-    byte buffer[MAX_INSTR];
-    struct instr instr;
-    int instr_length;
-    int i;
+static int scan_resolve(qword target, struct scan_region *reg, dword *relip, void *ctx) {
+    struct ne *ne = ctx;
+    word cs = target >> 16, ip = target & 0xffff;
+    struct segment *seg = &ne->segments[cs-1];
 
     if (ip >= seg->length) {
         warn_at("Attempt to scan past end of segment.\n");
-        return;
+        return 0;
     }
 
-    if ((seg->instr_flags[ip] & (INSTR_VALID|INSTR_SCANNED)) == INSTR_SCANNED)
-        warn_at("Attempt to scan byte that does not begin instruction.\n");
+    scan_seg = seg;
+    reg->start = seg->start;
+    reg->base = 0;
+    reg->length = seg->length;
+    reg->min_alloc = seg->min_alloc;
+    reg->flags = seg->instr_flags;
+    reg->bits = (seg->flags & 0x2000) ? 32 : 16;
+    *relip = ip;
+    return 1;
+}
 
-    while (ip < seg->length) {
-        /* check if we already read from here */
-        if (seg->instr_flags[ip] & INSTR_SCANNED) return;
-
-        /* read the instruction */
-        memset(buffer, 0, sizeof(buffer));
-        memcpy(buffer, read_data(seg->start + ip), min(sizeof(buffer), seg->length - ip));
-        instr_length = get_instr(ip, buffer, &instr, (seg->flags & 0x2000) ? 32 : 16);
-
-        /* mark the bytes */
-        seg->instr_flags[ip] |= INSTR_VALID;
-        for (i = ip; i < ip+instr_length && i < seg->min_alloc; i++) seg->instr_flags[i] |= INSTR_SCANNED;
-
-        /* instruction which hangs over the minimum allocation */
-        if (i < ip+instr_length && i == seg->min_alloc) break;
-
-        /* handle conditional and unconditional jumps */
-        if (instr.op.arg0 == PTR32) {
-            for (i = ip; i < ip+instr_length; i++) {
-                if (seg->instr_flags[i] & INSTR_RELOC) {
-                    const struct reloc *r = get_reloc(seg, i);
-                    const struct segment *tseg;
-
-                    if (!r) break;
-                    tseg = &ne->segments[r->tseg-1];
-
-                    if (r->type != 0) break;
-
-                    if (r->size == 3) {
-                        /* 32-bit relocation on 32-bit pointer */
-                        tseg->instr_flags[r->toffset] |= INSTR_FAR;
-                        if (!strcmp(instr.op.name, "call"))
-                            tseg->instr_flags[r->toffset] |= INSTR_FUNC;
-                        else
-                            tseg->instr_flags[r->toffset] |= INSTR_JUMP;
-                        scan_segment(r->tseg, r->toffset, ne);
-                    } else if (r->size == 2) {
-                        /* segment relocation on 32-bit pointer */
-                        tseg->instr_flags[instr.args[0].value] |= INSTR_FAR;
-                        if (!strcmp(instr.op.name, "call"))
-                            tseg->instr_flags[instr.args[0].value] |= INSTR_FUNC;
-                        else
-                            tseg->instr_flags[instr.args[0].value] |= INSTR_JUMP;
-                        scan_segment(r->tseg, instr.args[0].value, ne);
-                    }
-
-                    break;
+static void scan_visit(struct instr *instr, dword relip, int instr_length,
+    const struct scan_region *reg, void *ctx)
+{
+    struct ne *ne = ctx;
+    struct segment *seg = scan_seg;
+    dword i;
+
+    /* handle conditional and unconditional jumps */
+    if (instr->op.arg0 == PTR32) {
+        for (i = relip; i < relip+instr_length; i++) {
+            if (seg->instr_flags[i] & INSTR_RELOC) {
+                const struct reloc *r = get_reloc(seg, i);
+                const struct segment *tseg;
+
+                if (!r) break;
+                tseg = &ne->segments[r->tseg-1];
+
+                if (r->type != 0) break;
+
+                if (r->size == 3) {
+                    /* 32-bit relocation on 32-bit pointer */
+                    tseg->instr_flags[r->toffset] |= INSTR_FAR;
+                    if (!strcmp(instr->op.name, "call"))
+                        tseg->instr_flags[r->toffset] |= INSTR_FUNC;
+                    else
+                        tseg->instr_flags[r->toffset] |= INSTR_JUMP;
+                    scan_push(((qword)r->tseg << 16) | r->toffset);
+                } else if (r->size == 2) {
+                    /* segment relocation on 32-bit pointer */
+                    tseg->instr_flags[instr->args[0].value] |= INSTR_FAR;
+                    if (!strcmp(instr->op.name, "call"))
+                        tseg->instr_flags[instr->args[0].value] |= INSTR_FUNC;
+                    else
+                        tseg->instr_flags[instr->args[0].value] |= INSTR_JUMP;
+                    scan_push(((qword)r->tseg << 16) | instr->args[0].value);
                 }
+
+                break;
             }
-        } else if (instr.op.flags & OP_BRANCH) {
-            /* near relative jump, loop, or call */
-            if (!strcmp(instr.op.name, "call"))
-                seg->instr_flags[instr.args[0].value] |= INSTR_FUNC;
+        }
+    } else if (instr->op.flags & OP_BRANCH) {
+        /* near relative jump, loop, or call */
+        if (instr->args[0].value < seg->min_alloc) {
+            if (!strcmp(instr->op.name, "call"))
+                seg->instr_flags[instr->args[0].value] |= INSTR_FUNC;
             else
-                seg->instr_flags[instr.args[0].value] |= INSTR_JUMP;
+                seg->instr_flags[instr->args[0].value] |= INSTR_JUMP;
 
             /* scan it */
-            scan_segment(cs, instr.args[0].value, ne);
+            scan_push(((qword)seg->cs << 16) | instr->args[0].value);
+        } else {
+            word cs = seg->cs, ip = relip;
+            warn_at("Branch '%s' to byte %lx not in segment.\n",
+                instr->op.name, instr->args[0].value);
         }
+    }
+}
 
-        if (instr.op.flags & OP_STOP)
-            return;
+static void scan_warn(qword addr, const char *msg, void *ctx) {
+    word cs = scan_seg->cs, ip = addr;
+    warn_at("%s", msg);
+}
 
-        ip += instr_length;
-    }
+static void scan_segment(word cs, word ip, struct ne *ne) {
+    struct scan_format fmt = { scan_resolve, scan_visit, scan_warn,
+        "Scan reached the end of segment.\n", ne };
 
-    warn_at("Scan reached the end of segment.\n");
+    scan_push(((qword)cs << 16) | ip);
+    scan_run(&fmt);
 }
 
 static void print_segment_flags(word flags) {
@@ -412,7 +442,7 @@ static void read_reloc(const struct segment *seg, word index, struct ne *ne)
             offset_cursor = next;
     } while (next < 0xFFFb);
 
-    r->offsets = malloc(r->offset_count*sizeof(word *));
+    r->offsets = arena_alloc(r->offset_count*sizeof(word *));
 
     offset_cursor = offset;
     r->offset_count = 0;
@@ -432,13 +462,32 @@ static void read_reloc(const struct segment *seg, word index, struct ne *ne)
     } while (next < 0xFFFb);
 }
 
-static void free_reloc(struct reloc *reloc_data, word reloc_count) {
-    int i;
-    for (i = 0; i < reloc_count; i++) {
-        free(reloc_data[i].offsets);
+static int reloc_offset_cmp(const void *a, const void *b) {
+    const struct reloc_offset *ra = a, *rb = b;
+    return (int)ra->offset - (int)rb->offset;
+}
+
+/* Flatten the per-reloc offset lists into one sorted index so that
+ * get_reloc() can resolve an address in logarithmic time. */
+static void build_reloc_index(struct segment *seg) {
+    unsigned i, o, count = 0;
+
+    for (i = 0; i < seg->reloc_count; i++)
+        count += seg->reloc_table[i].offset_count;
+
+    seg->reloc_offsets = arena_alloc(count * sizeof(struct reloc_offset));
+    seg->reloc_offset_count = count;
+
+    count = 0;
+    for (i = 0; i < seg->reloc_count; i++) {
+        for (o = 0; o < seg->reloc_table[i].offset_count; o++) {
+            seg->reloc_offsets[count].offset = seg->reloc_table[i].offsets[o];
+            seg->reloc_offsets[count].index = i;
+            count++;
+        }
     }
 
-    free(reloc_data);
+    qsort(seg->reloc_offsets, count, sizeof(struct reloc_offset), reloc_offset_cmp);
 }
 
 void read_segments(off_t start, struct ne *ne)
@@ -449,7 +498,7 @@ void read_segments(off_t start, struct ne *ne)
     struct segment *seg;
     word i, j;
 
-    ne->segments = malloc(count * sizeof(struct segment));
+    ne->segments = arena_alloc(count * sizeof(struct segment));
 
     for (i = 0; i < count; ++i)
     {
@@ -461,7 +510,7 @@ void read_segments(off_t start, struct ne *ne)
         seg->min_alloc = read_word(start + i*8 + 6);
 
         /* Use min_alloc rather than length because data can "hang over". */
-        seg->instr_flags = calloc(seg->min_alloc, sizeof(byte));
+        seg->instr_flags = arena_calloc(seg->min_alloc, sizeof(byte));
     }
 
     /* First pass: just read the relocation data */
@@ -471,7 +520,7 @@ void read_segments(off_t start, struct ne *ne)
 
         if (seg->flags & 0x0100) {
             seg->reloc_count = read_word(seg->start + seg->length);
-            seg->reloc_table = malloc(seg->reloc_count * sizeof(struct reloc));
+            seg->reloc_table = arena_alloc(seg->reloc_count * sizeof(struct reloc));
 
             for (j = 0; j < seg->reloc_count; j++)
                 read_reloc(seg, j, ne);
@@ -479,8 +528,19 @@ void read_segments(off_t start, struct ne *ne)
             seg->reloc_count = 0;
             seg->reloc_table = NULL;
         }
+
+        build_reloc_index(seg);
+    }
+
+    /* The scan hops between branch targets, so pull the code segments in
+     * ahead of it rather than faulting their pages at random. */
+    for (i = 0; i < count; ++i) {
+        if (!(ne->segments[i].flags & 0x0001))
+            map_advise_willneed(ne->segments[i].start, ne->segments[i].length);
     }
 
+    perf_enter(PERF_SCAN);
+
     /* Second pass: scan entry points (we have to do this after we read
      * relocation data for all segments.) */
     for (i = 0; i < ne->entcount; i++) {
@@ -512,19 +572,8 @@ void read_segments(off_t start, struct ne *ne)
         ne->segments[entry_cs-1].instr_flags[entry_ip] |= INSTR_FUNC;
         scan_segment(entry_cs, entry_ip, ne);
     }
-}
-
-void free_segments(struct ne *ne) {
-    unsigned cs;
-    struct segment *seg;
-
-    for (cs = 1; cs <= ne->header.ne_cseg; cs++) {
-        seg = &ne->segments[cs-1];
-        free_reloc(seg->reloc_table, seg->reloc_count);
-        free(seg->instr_flags);
-    }
 
-    free(ne->segments);
+    perf_leave(PERF_SCAN);
 }
 
 void print_segments(struct ne *ne) {
@@ -535,6 +584,8 @@ void print_segments(struct ne *ne) {
     for (cs = 1; cs <= ne->header.ne_cseg; cs++) {
         seg = &ne->segments[cs-1];
 
+        map_advise_willneed(seg->start, seg->length);
+
         putchar('\n');
         printf("Segment %d (start = 0x%lx, length = 0x%x, minimum allocation = 0x%x):\n",
             cs, seg->start, seg->length, seg->min_alloc ? seg->min_alloc : 65536);
@@ -550,5 +601,8 @@ void print_segments(struct ne *ne) {
                 print_data(seg);
             print_disassembly(seg, ne);
         }
+
+        /* done with this segment's pages */
+        map_advise_done(seg->start, seg->length);
     }
 }
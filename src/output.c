@@ -0,0 +1,157 @@
+/*
+ * Buffered output writer
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "perf.h"
+
+/* One large append buffer for the hot printing paths. The printers append
+ * with an explicit cursor and flush once per segment or section, so that
+ * disassembly throughput isn't bound by per-line stdio locking. Callers
+ * must flush before printing to stdout by other means. */
+
+static char *out_buf;
+static size_t out_len;
+static size_t out_cap;
+
+static void out_reserve(size_t len) {
+    if (out_len + len <= out_cap)
+        return;
+    if (!out_cap)
+        out_cap = 0x10000;
+    while (out_len + len > out_cap)
+        out_cap *= 2;
+    out_buf = realloc(out_buf, out_cap);
+    if (!out_buf) {
+        perror("Out of memory");
+        exit(1);
+    }
+}
+
+void out_char(char c) {
+    out_reserve(1);
+    out_buf[out_len++] = c;
+}
+
+void out_str(const char *str) {
+    size_t len = strlen(str);
+    out_reserve(len);
+    memcpy(out_buf + out_len, str, len);
+    out_len += len;
+}
+
+void out_fmt(const char *format, ...) {
+    va_list args;
+    int len;
+
+    out_reserve(128);
+    va_start(args, format);
+    len = vsnprintf(out_buf + out_len, out_cap - out_len, format, args);
+    va_end(args);
+    if (len >= (int)(out_cap - out_len)) {
+        out_reserve(len + 1);
+        va_start(args, format);
+        vsnprintf(out_buf + out_len, out_cap - out_len, format, args);
+        va_end(args);
+    }
+    out_len += len;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Append the body of one hexdump line: sixteen three-character hex columns
+ * (blank past len), two spaces, the printable-ASCII column, and a newline.
+ * The caller prints its own address prefix first. A printf per byte is slow
+ * enough to dominate -s output on large sections. */
+void out_hexdump_line(const unsigned char *data, int len) {
+    char *out;
+    int i;
+
+    out_reserve(16 * 3 + 2 + 16 + 1);
+    out = out_buf + out_len;
+    for (i = 0; i < len; i++) {
+        *out++ = ' ';
+        *out++ = hex_digits[data[i] >> 4];
+        *out++ = hex_digits[data[i] & 0xf];
+    }
+    for (; i < 16; i++) {
+        *out++ = ' ';
+        *out++ = ' ';
+        *out++ = ' ';
+    }
+    *out++ = ' ';
+    *out++ = ' ';
+    for (i = 0; i < len; i++)
+        *out++ = isprint(data[i]) ? data[i] : '.';
+    *out++ = '\n';
+    out_len = out - out_buf;
+}
+
+/* Append length bytes with C-style escapes, as in a string literal. The
+ * caller prints the surrounding quotes. */
+void out_escaped(const unsigned char *data, size_t length) {
+    char *out;
+    size_t i;
+
+    /* worst case is \xNN for every byte */
+    out_reserve(length * 4);
+    out = out_buf + out_len;
+    for (i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        if (c == '\t') {
+            *out++ = '\\';
+            *out++ = 't';
+        } else if (c == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else if (c == '\r') {
+            *out++ = '\\';
+            *out++ = 'r';
+        } else if (c == '"') {
+            *out++ = '\\';
+            *out++ = '"';
+        } else if (c == '\\') {
+            *out++ = '\\';
+            *out++ = '\\';
+        } else if (c >= ' ' && c <= '~')
+            *out++ = c;
+        else {
+            *out++ = '\\';
+            *out++ = 'x';
+            *out++ = hex_digits[c >> 4];
+            *out++ = hex_digits[c & 0xf];
+        }
+    }
+    out_len = out - out_buf;
+}
+
+void out_flush(void) {
+    PERF_ADD(bytes_out, out_len);
+    if (out_len)
+        fwrite(out_buf, 1, out_len, stdout);
+    out_len = 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Buffered output writer
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <stddef.h>
+
+extern void out_char(char c);
+extern void out_str(const char *str);
+extern void out_fmt(const char *format, ...);
+extern void out_hexdump_line(const unsigned char *data, int len);
+extern void out_escaped(const unsigned char *data, size_t length);
+extern void out_flush(void);
+
+#endif /* __OUTPUT_H */
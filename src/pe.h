@@ -111,6 +111,12 @@ struct section {
     byte *instr_flags;
 };
 
+/* sorted (address -> section) index, built once the section table is read */
+struct section_index {
+    dword address;
+    unsigned index; /* into sections */
+};
+
 struct reloc_pe
 {
     dword offset;
@@ -125,6 +131,12 @@ struct export {
     const char *name;
 };
 
+/* sorted (address -> export) index, built once the export table is read */
+struct export_index {
+    dword address;
+    unsigned index;     /* into exports */
+};
+
 struct import_module {
     const char *module;
     dword iat_addr;
@@ -154,9 +166,11 @@ struct pe {
     const char *name;
 
     struct section *sections;
+    struct section_index *secidx;
 
     struct export *exports;
     unsigned export_count;
+    struct export_index *expidx;
 
     struct import_module *imports;
     unsigned import_count;
@@ -166,6 +180,7 @@ struct pe {
 };
 
 /* in pe_section.c */
+extern void build_section_index(struct pe *pe);
 extern struct section *addr2section(dword addr, const struct pe *pe);
 extern off_t addr2offset(dword addr, const struct pe *pe);
 extern void read_sections(struct pe *pe);
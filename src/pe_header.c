@@ -24,8 +24,10 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
 #include "semblance.h"
 #include "pe.h"
+#include "perf.h"
 
 static void print_flags(word flags) {
     char buffer[1024] = "";
@@ -192,7 +194,7 @@ static void print_header(struct pe *pe) {
 static void print_specfile(struct pe *pe) {
     int i;
     FILE *specfile;
-    char *spec_name = malloc(strlen(pe->name) + 4);
+    char *spec_name = arena_alloc(strlen(pe->name) + 4);
     sprintf(spec_name, "%s.ord", pe->name);
     specfile = fopen(spec_name, "w");
 
@@ -223,6 +225,27 @@ struct export_header {
 
 STATIC_ASSERT(sizeof(struct export_header) == 0x28);
 
+static int export_index_cmp(const void *a, const void *b) {
+    const struct export_index *ea = a, *eb = b;
+    if (ea->address != eb->address)
+        return (ea->address > eb->address) - (ea->address < eb->address);
+    /* keep table order for duplicate addresses */
+    return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+/* Build an (address -> export) index so that get_export_name() can resolve
+ * an address in logarithmic time. */
+static void build_export_index(struct pe *pe) {
+    unsigned i;
+
+    pe->expidx = arena_alloc(pe->export_count * sizeof(struct export_index));
+    for (i = 0; i < pe->export_count; i++) {
+        pe->expidx[i].address = pe->exports[i].address;
+        pe->expidx[i].index = i;
+    }
+    qsort(pe->expidx, pe->export_count, sizeof(struct export_index), export_index_cmp);
+}
+
 static void get_export_table(struct pe *pe) {
     const struct export_header *header;
     dword address;
@@ -234,8 +257,11 @@ static void get_export_table(struct pe *pe) {
     header = read_data(addr2offset(pe->dirs[0].address, pe));
     offset = addr2offset(header->addr_table_addr, pe);
 
-    /* Grab the name. */
+    /* Grab the name. We print it for every mode, but the export list
+     * itself is only worth parsing when something will consume it. */
     pe->name = read_data(addr2offset(header->module_name_addr, pe));
+    if (!(mode & (DUMPEXPORT | SPECFILE | DISASSEMBLE)))
+        return;
 
     /* If a DLL exports by ordinal and there are holes, they will have a 0
      * address. We don't really want to put them in our table in that case, so
@@ -248,7 +274,7 @@ static void get_export_table(struct pe *pe) {
     }
 
     /* Grab the exports. */
-    pe->exports = malloc(pe->export_count * sizeof(struct export));
+    pe->exports = arena_alloc(pe->export_count * sizeof(struct export));
 
     /* If addr_table_count exceeds export_count, this means that some exports
      * are nameless (and thus exported by ordinal). */
@@ -273,6 +299,8 @@ static void get_export_table(struct pe *pe) {
         dword name_addr = read_dword(addr2offset(header->name_table_addr, pe) + (i * sizeof(dword)));
         pe->exports[index].name = read_data(addr2offset(name_addr, pe));
     }
+
+    build_export_index(pe);
 }
 
 static void get_import_name_table(struct import_module *module, dword nametab_addr, struct pe *pe)
@@ -286,7 +314,7 @@ static void get_import_name_table(struct import_module *module, dword nametab_ad
     else
         while (read_qword(offset + count * 8)) count++;
 
-    module->nametab = malloc(count * sizeof(*module->nametab));
+    module->nametab = arena_alloc(count * sizeof(*module->nametab));
 
     for (i = 0; i < count; i++) {
         qword address;
@@ -317,7 +345,7 @@ static void get_import_module_table(struct pe *pe) {
     while (memcmp(read_data(offset + pe->import_count * 20), zeroes, 20))
         pe->import_count++;
 
-    pe->imports = malloc(pe->import_count * sizeof(struct import_module));
+    pe->imports = arena_alloc(pe->import_count * sizeof(struct import_module));
 
     for (i = 0; i < pe->import_count; i++)
     {
@@ -327,6 +355,13 @@ static void get_import_module_table(struct pe *pe) {
     }
 }
 
+static int reloc_cmp(const void *a, const void *b) {
+    const struct reloc_pe *ra = a, *rb = b;
+    if (ra->offset < rb->offset) return -1;
+    if (ra->offset > rb->offset) return 1;
+    return 0;
+}
+
 static void get_reloc_table(struct pe *pe) {
     off_t offset = addr2offset(pe->dirs[5].address, pe), cursor = offset;
     unsigned i, reloc_idx = 0;
@@ -338,7 +373,7 @@ static void get_reloc_table(struct pe *pe) {
         cursor += read_dword(cursor + 4);
     }
 
-    pe->relocs = malloc(pe->reloc_count * sizeof(*pe->relocs));
+    pe->relocs = arena_alloc(pe->reloc_count * sizeof(*pe->relocs));
     cursor = offset;
     while (cursor < offset + pe->dirs[5].size)
     {
@@ -354,6 +389,10 @@ static void get_reloc_table(struct pe *pe) {
         }
         cursor += block_size;
     }
+
+    /* The block structure yields them almost, but not quite, in order;
+     * sort so that get_reloc() can binary-search. */
+    qsort(pe->relocs, pe->reloc_count, sizeof(*pe->relocs), reloc_cmp);
 }
 
 void readpe(off_t offset_pe, struct pe *pe)
@@ -383,20 +422,23 @@ void readpe(off_t offset_pe, struct pe *pe)
     offset += cdirs * sizeof(struct directory);
 
     /* read the section table */
-    pe->sections = malloc(pe->header->NumberOfSections * sizeof(struct section));
+    pe->sections = arena_alloc(pe->header->NumberOfSections * sizeof(struct section));
     for (i = 0; i < pe->header->NumberOfSections; i++)
     {
         memcpy(&pe->sections[i], read_data(offset + i*0x28), 0x28);
 
-        /* allocate zeroes, but only if it's a code section */
+        /* allocate zeroes, but only if it's a code section and we're
+         * going to disassemble it */
         /* in theory nobody will ever try to jump into a data section.
          * VirtualProtect() be damned */
-        if (pe->sections[i].flags & 0x20)
-            pe->sections[i].instr_flags = calloc(pe->sections[i].min_alloc, sizeof(byte));
+        if ((mode & DISASSEMBLE) && (pe->sections[i].flags & 0x20))
+            pe->sections[i].instr_flags = arena_calloc(pe->sections[i].min_alloc, sizeof(byte));
         else
             pe->sections[i].instr_flags = NULL;
     }
 
+    build_section_index(pe);
+
     /* Read the Data Directories.
      * PE is bizarre. It tries to make all of these things generic by putting
      * them in separate "directories". But the order of these seems to be fixed
@@ -404,9 +446,9 @@ void readpe(off_t offset_pe, struct pe *pe)
 
     if (cdirs >= 1 && pe->dirs[0].size)
         get_export_table(pe);
-    if (cdirs >= 2 && pe->dirs[1].size)
+    if ((mode & (DUMPIMPORT | DISASSEMBLE)) && cdirs >= 2 && pe->dirs[1].size)
         get_import_module_table(pe);
-    if (cdirs >= 6 && pe->dirs[5].size)
+    if ((mode & DISASSEMBLE) && cdirs >= 6 && pe->dirs[5].size)
         get_reloc_table(pe);
 
     /* Read the code. */
@@ -414,17 +456,64 @@ void readpe(off_t offset_pe, struct pe *pe)
         read_sections(pe);
 }
 
-void freepe(struct pe *pe) {
-    int i;
+/* Emit the same information as the pretty printers, but as tab-separated
+ * records that scripts can split without a regex for every line. */
+static void print_structured(struct pe *pe)
+{
+    int i, j;
 
-    for (i = 0; i < pe->header->NumberOfSections; i++)
-        free(pe->sections[i].instr_flags);
-    free(pe->sections);
-    free(pe->exports);
-    for (i = 0; i < pe->import_count; i++)
-        free(pe->imports[i].nametab);
-    free(pe->relocs);
-    free(pe->imports);
+    printf("module\tpe\t%s\n", pe->name ? pe->name : "");
+
+    if (mode & DUMPHEADER) {
+        printf("header\tmachine\t%04x\n", pe->header->Machine);
+        printf("header\tcharacteristics\t%04x\n", pe->header->Characteristics);
+        printf("header\timage_type\t%d\n", pe->magic == 0x10b ? 32 : 64);
+        if (pe->magic == 0x10b) {
+            const struct optional_header *opt = pe->opt32;
+            printf("header\tlinker_version\t%d.%d\n",
+                opt->MajorLinkerVersion, opt->MinorLinkerVersion);
+            printf("header\tfile_version\t%d.%d\n",
+                opt->MajorImageVersion, opt->MinorImageVersion);
+            printf("header\tentry_point\t0x%x\n", opt->AddressOfEntryPoint);
+            printf("header\timage_base\t0x%x\n", opt->ImageBase);
+            printf("header\tsubsystem\t%d\n", opt->Subsystem);
+            printf("header\tdll_characteristics\t%04x\n", opt->DllCharacteristics);
+        } else if (pe->magic == 0x20b) {
+            const struct optional_header_pep *opt = pe->opt64;
+            printf("header\tlinker_version\t%d.%d\n",
+                opt->MajorLinkerVersion, opt->MinorLinkerVersion);
+            printf("header\tfile_version\t%d.%d\n",
+                opt->MajorImageVersion, opt->MinorImageVersion);
+            printf("header\tentry_point\t0x%x\n", opt->AddressOfEntryPoint);
+            printf("header\timage_base\t0x%lx\n", opt->ImageBase);
+            printf("header\tsubsystem\t%d\n", opt->Subsystem);
+            printf("header\tdll_characteristics\t%04x\n", opt->DllCharacteristics);
+        }
+    }
+
+    /* addresses are left relative to the image base, whatever --pe-rel-addr
+     * says; consumers that want absolute addresses have the base above */
+    if (mode & DUMPEXPORT) {
+        for (i = 0; i < pe->export_count; i++)
+            printf("export\t%u\t0x%x\t%s\n", pe->exports[i].ordinal,
+                pe->exports[i].address,
+                pe->exports[i].name ? pe->exports[i].name : "");
+    }
+
+    if (mode & DUMPIMPORT) {
+        for (i = 0; i < pe->import_count; i++) {
+            printf("import\t%s\n", pe->imports[i].module);
+            for (j = 0; j < pe->imports[i].count; j++)
+            {
+                if (pe->imports[i].nametab[j].is_ordinal)
+                    printf("importfn\t%s\tord:%u\n", pe->imports[i].module,
+                        pe->imports[i].nametab[j].ordinal);
+                else
+                    printf("importfn\t%s\t%s\n", pe->imports[i].module,
+                        pe->imports[i].nametab[j].name);
+            }
+        }
+    }
 }
 
 void dumppe(long offset_pe) {
@@ -435,7 +524,11 @@ void dumppe(long offset_pe) {
 
     if (mode == SPECFILE) {
         print_specfile(&pe);
-        freepe(&pe);
+        return;
+    }
+
+    if (opts & STRUCTURED) {
+        print_structured(&pe);
         return;
     }
 
@@ -505,8 +598,9 @@ void dumppe(long offset_pe) {
             printf("No imported module table\n");
     }
 
-    if (mode & DISASSEMBLE)
+    if (mode & DISASSEMBLE) {
+        perf_enter(PERF_FORMAT);
         print_sections(&pe);
-
-    freepe(&pe);
+        perf_leave(PERF_FORMAT);
+    }
 }
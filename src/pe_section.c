@@ -21,10 +21,17 @@
  */
 
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "arena.h"
 #include "semblance.h"
 #include "pe.h"
+#include "output.h"
+#include "perf.h"
 #include "x86_instr.h"
+#include "x86_scan.h"
 
 #ifdef USE_WARN
 #define warn_at(...) \
@@ -36,15 +43,92 @@
 
 int pe_rel_addr = -1;
 
+static int section_index_cmp(const void *a, const void *b) {
+    const struct section_index *sa = a, *sb = b;
+    if (sa->address != sb->address)
+        return (sa->address > sb->address) - (sa->address < sb->address);
+    /* keep table order for duplicate addresses */
+    return (sa->index > sb->index) - (sa->index < sb->index);
+}
+
+/* Annotation cache. A hot import thunk is referenced from thousands of
+ * call sites, and every one of them used to re-resolve and re-format the
+ * same name; instead, intern the result (or its absence) per target
+ * address the first time it's seen. Lives in the arena, so it's freed
+ * with everything else per file; the table itself is reset below in
+ * build_section_index(). */
+struct annot {
+    qword addr;
+    const char *text;
+    byte used;
+    byte final;     /* resolved through a thunk; don't try anything else */
+};
+
+static struct annot *annots;
+static unsigned annot_count, annot_alloc;
+
+static struct annot *annot_probe(struct annot *table, unsigned alloc, qword addr) {
+    unsigned i = (dword)((addr * 0x9e3779b97f4a7c15ull) >> 32) & (alloc - 1);
+
+    while (table[i].used && table[i].addr != addr)
+        i = (i + 1) & (alloc - 1);
+    return &table[i];
+}
+
+static struct annot *annot_slot(qword addr) {
+    unsigned i;
+
+    if (annot_count * 4 >= annot_alloc * 3) {
+        struct annot *old = annots;
+        unsigned old_alloc = annot_alloc;
+
+        annot_alloc = annot_alloc ? annot_alloc * 2 : 1024;
+        annots = arena_calloc(annot_alloc, sizeof(*annots));
+        for (i = 0; i < old_alloc; i++)
+            if (old[i].used)
+                *annot_probe(annots, annot_alloc, old[i].addr) = old[i];
+    }
+
+    return annot_probe(annots, annot_alloc, addr);
+}
+
+/* Build an (address -> section) index so that addr2section() doesn't have
+ * to walk the section table for every branch target and argument. */
+void build_section_index(struct pe *pe) {
+    unsigned i;
+
+    pe->secidx = arena_alloc(pe->header->NumberOfSections * sizeof(struct section_index));
+    for (i = 0; i < pe->header->NumberOfSections; i++) {
+        pe->secidx[i].address = pe->sections[i].address;
+        pe->secidx[i].index = i;
+    }
+    qsort(pe->secidx, pe->header->NumberOfSections, sizeof(struct section_index), section_index_cmp);
+
+    /* the previous file's annotations went away with its arena */
+    annots = NULL;
+    annot_count = annot_alloc = 0;
+}
+
 struct section *addr2section(dword addr, const struct pe *pe) {
     /* Even worse than the below, some data is sensitive to which section it's in! */
 
-    int i;
-    for (i = 0; i < pe->header->NumberOfSections; i++) {
-         if (addr >= pe->sections[i].address && addr < pe->sections[i].address + pe->sections[i].min_alloc)
-            return &pe->sections[i];
+    unsigned lo = 0, hi = pe->header->NumberOfSections;
+    struct section *sec;
+
+    /* find the last section starting at or below addr; sections aren't
+     * supposed to overlap, so it's the only candidate */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (pe->secidx[mid].address <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
+    if (!lo) return NULL;
+    sec = &pe->sections[pe->secidx[lo - 1].index];
+    if (addr >= sec->address && addr < sec->address + sec->min_alloc)
+        return sec;
     return NULL;
 }
 
@@ -61,11 +145,18 @@ off_t addr2offset(dword addr, const struct pe *pe) {
 
 /* index function */
 static const char *get_export_name(dword ip, const struct pe *pe) {
-    int i;
-    for (i = 0; i < pe->export_count; i++) {
-        if (pe->exports[i].address == ip)
-            return pe->exports[i].name;
+    unsigned lo = 0, hi = pe->export_count;
+
+    /* binary search over the sorted address index */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (pe->expidx[mid].address < ip)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < pe->export_count && pe->expidx[lo].address == ip)
+        return pe->exports[pe->expidx[lo].index].name;
     return NULL;
 }
 
@@ -95,10 +186,19 @@ static const char *get_imported_name(dword offset, const struct pe *pe) {
 
 /* index function */
 static const struct reloc_pe *get_reloc(dword ip, const struct pe *pe) {
-    unsigned i;
-    for (i=0; i<pe->reloc_count; i++) {
-        if (pe->relocs[i].offset == ip)
-            return &pe->relocs[i];
+    unsigned lo = 0, hi = pe->reloc_count;
+
+    PERF_COUNT(reloc_lookups);
+
+    /* the reloc table is sorted by offset in get_reloc_table() */
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (pe->relocs[mid].offset < ip)
+            lo = mid + 1;
+        else if (pe->relocs[mid].offset > ip)
+            hi = mid;
+        else
+            return &pe->relocs[mid];
     }
     return NULL;
 }
@@ -122,6 +222,56 @@ static char *relocate_arg(const struct instr *instr, const struct arg *arg, cons
     return NULL;
 }
 
+/* Resolve a target address to an imported or exported name, interning the
+ * result so that later references to the same target are one hash lookup. */
+static const struct annot *get_target_annot(qword addr, const struct pe *pe) {
+    struct annot *a = annot_slot(addr);
+    const char *name;
+
+    if (a->used)
+        return a;
+
+    a->used = 1;
+    a->addr = addr;
+    annot_count++;
+
+    if ((name = get_imported_name(addr, pe)))
+        a->text = arena_strdup(name);   /* may be a static buffer */
+    else if ((name = get_export_name(addr, pe)))
+        a->text = name;
+    else if (read_word(addr2offset(addr, pe)) == 0x25ff) { /* absolute jmp */
+        /* Sometimes we have TWO levels of indirection—call to jmp to
+         * relocated address. mingw-w64 does this. */
+        a->final = 1;
+        if ((name = get_imported_name(read_dword(addr2offset(addr, pe) + 2), pe)))
+            a->text = arena_strdup(name);
+    }
+
+    return a;
+}
+
+/* The same, for 64-bit IP-relative references; these resolve in a slightly
+ * different order, so keep them in their own part of the key space. */
+static const struct annot *get_riprel_annot(dword tip, const struct pe *pe) {
+    qword addr = ((qword)1 << 63) | tip;
+    struct annot *a = annot_slot(addr);
+    const char *name;
+
+    if (a->used)
+        return a;
+
+    a->used = 1;
+    a->addr = addr;
+    annot_count++;
+
+    if ((name = get_imported_name(tip + pe->imagebase, pe)))
+        a->text = arena_strdup(name);
+    else if ((name = get_export_name(tip, pe)))
+        a->text = name;
+
+    return a;
+}
+
 static const char *get_arg_comment(const struct section *sec,
         const struct instr *instr, const struct arg *arg, const struct pe *pe)
 {
@@ -139,16 +289,12 @@ static const char *get_arg_comment(const struct section *sec,
      * has a relocation entry. */
     if (addr2section(arg->value - pe->imagebase, pe) || (sec->instr_flags[arg->ip - sec->address] & INSTR_RELOC))
     {
-        if ((comment = get_imported_name(arg->value, pe)))
-            return comment;
-        if ((comment = get_export_name(arg->value, pe)))
-            return comment;
+        const struct annot *a = get_target_annot(arg->value, pe);
 
-        /* Sometimes we have TWO levels of indirection—call to jmp to
-         * relocated address. mingw-w64 does this. */
-
-        if (read_word(addr2offset(arg->value, pe)) == 0x25ff) /* absolute jmp */
-            return get_imported_name(read_dword(addr2offset(arg->value, pe) + 2), pe);
+        if (a->text)
+            return a->text;
+        if (a->final)
+            return NULL;
 
         if ((comment = relocate_arg(instr, arg, pe)))
             return comment;
@@ -161,9 +307,9 @@ static const char *get_arg_comment(const struct section *sec,
     return NULL;
 }
 
-static int print_pe_instr(const struct section *sec, dword ip, byte *p, const struct pe *pe) {
-    struct instr instr = {0};
-    unsigned len;
+/* Format one instruction already decoded by decode_block(). */
+static void print_pe_instr(const struct section *sec, dword ip, byte *p, int len,
+    struct instr *instr, const struct pe *pe) {
     const char *comment = NULL;
     char ip_string[17];
     qword absip = ip;
@@ -173,15 +319,13 @@ static int print_pe_instr(const struct section *sec, dword ip, byte *p, const st
     if (!pe_rel_addr)
         absip += pe->imagebase;
 
-    len = get_instr(ip, p, &instr, bits);
-
     sprintf(ip_string, "%8lx", absip);
 
     /* We deal in relative addresses internally everywhere. That means we have
      * to fix up the values for relative jumps if we're not displaying relative
      * addresses. */
-    if ((instr.op.arg0 == REL8 || instr.op.arg0 == REL16) && !pe_rel_addr) {
-        instr.args[0].value += pe->imagebase;
+    if ((instr->op.arg0 == REL8 || instr->op.arg0 == REL16) && !pe_rel_addr) {
+        instr->args[0].value += pe->imagebase;
     }
 
     /* Check for relocations and imported names. PE separates the two concepts:
@@ -189,25 +333,22 @@ static int print_pe_instr(const struct section *sec, dword ip, byte *p, const st
      * relocated, and relocations proper are scattered throughout code sections
      * and relocated according to the contents of .reloc. */
 
-    if (!(comment = get_arg_comment(sec, &instr, &instr.args[0], pe)))
-        comment = get_arg_comment(sec, &instr, &instr.args[1], pe);
+    if (!(comment = get_arg_comment(sec, instr, &instr->args[0], pe)))
+        comment = get_arg_comment(sec, instr, &instr->args[1], pe);
 
     /* 64-bit does it with IP-relative addressing. */
-    if (!comment && instr.modrm_reg == 16) {
+    if (!comment && instr->modrm_reg == 16) {
         dword tip;
         qword abstip;
 
-        if (instr.args[0].type >= RM && instr.args[0].type <= MEM)
-            tip = ip + len + instr.args[0].value;
+        if (instr->args[0].type >= RM && instr->args[0].type <= MEM)
+            tip = ip + len + instr->args[0].value;
         else
-            tip = ip + len + instr.args[1].value;
+            tip = ip + len + instr->args[1].value;
         abstip = tip;
         if (!pe_rel_addr) abstip += pe->imagebase;
 
-        comment = get_imported_name(tip + pe->imagebase, pe);
-
-        if (!comment)
-            comment = get_export_name(tip, pe);
+        comment = get_riprel_annot(tip, pe)->text;
 
         if (!comment) {
             snprintf(comment_str, 10, "%lx", abstip);
@@ -215,16 +356,17 @@ static int print_pe_instr(const struct section *sec, dword ip, byte *p, const st
         }
     }
 
-    print_instr(ip_string, p, len, sec->instr_flags[ip - sec->address], &instr, comment, bits);
+    print_instr(ip_string, p, len, sec->instr_flags[ip - sec->address], instr, comment, bits);
 
-    return len;
 }
 
 static void print_disassembly(const struct section *sec, const struct pe *pe) {
+    const int bits = (pe->magic == 0x10b) ? 32 : 64;
     dword relip = 0, ip;
     qword absip;
 
-    byte buffer[MAX_INSTR];
+    struct instr_block block;
+    unsigned i;
 
     while (relip < sec->length && relip < sec->min_alloc) {
         /* find a valid instruction */
@@ -232,37 +374,45 @@ static void print_disassembly(const struct section *sec, const struct pe *pe) {
             if (opts & DISASSEMBLE_ALL) {
                 /* still skip zeroes */
                 if (read_byte(sec->offset + relip) == 0) {
-                    printf("     ...\n");
+                    out_str("     ...\n");
                     relip++;
                     while (read_byte(sec->offset + relip) == 0) relip++;
                 }
             } else {
-                printf("     ...\n");
+                out_str("     ...\n");
                 while ((relip < sec->length) && (relip < sec->min_alloc) && !(sec->instr_flags[relip] & INSTR_VALID)) relip++;
             }
         }
 
-        ip = relip + sec->address;
-        if (relip >= sec->length || relip >= sec->min_alloc) return;
+        if (relip >= sec->length || relip >= sec->min_alloc) {
+            out_flush();
+            return;
+        }
 
-        /* Instructions can "hang over" the end of a segment.
-         * Zero should be supplied. */
-        memset(buffer, 0, sizeof(buffer));
-        memcpy(buffer, read_data(sec->offset + relip), min(sizeof(buffer), sec->length - relip));
+        /* Decode a straight run of instructions, then format it. */
+        if (!decode_block(&block, sec->offset, sec->address, relip, sec->length,
+                sec->min_alloc, sec->instr_flags, bits))
+            break;
 
-        absip = ip;
-        if (!pe_rel_addr)
-            absip += pe->imagebase;
+        for (i = 0; i < block.count; i++) {
+            ip = block.ip[i] + sec->address;
+
+            absip = ip;
+            if (!pe_rel_addr)
+                absip += pe->imagebase;
 
-        if (sec->instr_flags[relip] & INSTR_FUNC) {
-            const char *name = get_export_name(ip, pe);
-            printf("\n");
-            printf("%lx <%s>:\n", absip, name ? name : "no name");
+            if (sec->instr_flags[block.ip[i]] & INSTR_FUNC) {
+                const char *name = get_export_name(ip, pe);
+                out_fmt("\n%lx <%s>:\n", absip, name ? name : "no name");
+            }
+
+            print_pe_instr(sec, ip, block.bytes[i], block.len[i], &block.instr[i], pe);
         }
 
-        relip += print_pe_instr(sec, ip, buffer, pe);
+        relip = block.ip[block.count - 1] + block.len[block.count - 1];
     }
-    putchar('\n');
+    out_char('\n');
+    out_flush();
 }
 
 static void print_data(const struct section *sec, struct pe *pe) {
@@ -275,135 +425,117 @@ static void print_data(const struct section *sec, struct pe *pe) {
 
     for (relip = 0; relip < length; relip += 16) {
         int len = min(length-relip, 16);
-        int i;
 
         absip = relip + sec->address;
         if (!pe_rel_addr)
             absip += pe->imagebase;
 
-        printf("%8lx", absip);
-        for (i=0; i<16; i++) {
-            if (i < len)
-                printf(" %02x", read_byte(sec->offset + relip + i));
-            else
-                printf("   ");
-        }
-        printf("  ");
-        for (i = 0; i < len; ++i)
-        {
-            char c = read_byte(sec->offset + relip + i);
-            putchar(isprint(c) ? c : '.');
-        }
-        putchar('\n');
+        out_fmt("%8lx", absip);
+        out_hexdump_line(read_data(sec->offset + relip), len);
     }
+    out_flush();
 }
 
-static void scan_segment(dword ip, struct pe *pe) {
+static int scan_resolve(qword target, struct scan_region *reg, dword *relip, void *ctx) {
+    struct pe *pe = ctx;
+    dword ip = target;
     struct section *sec = addr2section(ip, pe);
-    dword relip;
-
-    byte buffer[MAX_INSTR];
-    struct instr instr;
-    int instr_length;
-    int i;
-
-//    fprintf(stderr, "scanning at %x, in section %s\n", ip, sec ? sec->name : "<none>");
 
     if (!sec) {
         warn_at("Attempt to scan byte not in image.\n");
-        return;
+        return 0;
     }
 
-    relip = ip - sec->address;
-
-    if ((sec->instr_flags[relip] & (INSTR_VALID|INSTR_SCANNED)) == INSTR_SCANNED)
-        warn_at("Attempt to scan byte that does not begin instruction.\n");
-
     /* This code assumes that one stretch of code won't span multiple sections.
      * Is this a valid assumption? */
 
-    while (relip < sec->length) {
-        /* check if we've already read from here */
-        if (sec->instr_flags[relip] & INSTR_SCANNED) return;
+    reg->start = sec->offset;
+    reg->base = sec->address;
+    reg->length = sec->length;
+    reg->min_alloc = sec->min_alloc;
+    reg->flags = sec->instr_flags;
+    reg->bits = (pe->magic == 0x10b) ? 32 : 64;
+    *relip = ip - sec->address;
+    return 1;
+}
+
+static void scan_visit(struct instr *instr, dword relip, int instr_length,
+    const struct scan_region *reg, void *ctx)
+{
+    struct pe *pe = ctx;
+    dword ip = reg->base + relip;
+    dword i;
 
-        /* read the instruction */
-        memset(buffer, 0, sizeof(buffer));
-        memcpy(buffer, read_data(sec->offset + relip), min(sizeof(buffer), sec->length-relip));
-        instr_length = get_instr(ip, buffer, &instr, (pe->magic == 0x10b) ? 32 : 64);
+    /* handle conditional and unconditional jumps */
+    if (instr->op.flags & OP_BRANCH) {
+        /* relative jump, loop, or call */
+        struct section *tsec = addr2section(instr->args[0].value, pe);
 
-        /* mark the bytes */
-        sec->instr_flags[relip] |= INSTR_VALID;
-        for (i = relip; i < relip+instr_length && i < sec->min_alloc; i++) sec->instr_flags[i] |= INSTR_SCANNED;
+        if (tsec)
+        {
+            dword trelip = instr->args[0].value - tsec->address;
 
-        /* instruction which hangs over the minimum allocation */
-        if (i < relip+instr_length && i == sec->min_alloc) break;
+            if (!strcmp(instr->op.name, "call"))
+                tsec->instr_flags[trelip] |= INSTR_FUNC;
+            else
+                tsec->instr_flags[trelip] |= INSTR_JUMP;
 
-        /* handle conditional and unconditional jumps */
-        if (instr.op.flags & OP_BRANCH) {
-            /* relative jump, loop, or call */
-            struct section *tsec = addr2section(instr.args[0].value, pe);
+            /* scan it */
+            scan_push(instr->args[0].value);
+        } else
+            warn_at("Branch '%s' to byte %lx not in image.\n", instr->op.name, instr->args[0].value);
+    }
 
-            if (tsec)
-            {
-                dword trelip = instr.args[0].value - tsec->address;
-
-                if (!strcmp(instr.op.name, "call"))
-                    tsec->instr_flags[trelip] |= INSTR_FUNC;
-                else
-                    tsec->instr_flags[trelip] |= INSTR_JUMP;
-    
-                /* scan it */
-                scan_segment(instr.args[0].value, pe);
-            } else
-                warn_at("Branch '%s' to byte %lx not in image.\n", instr.op.name, instr.args[0].value);
-        }
+    for (i = relip; i < relip+instr_length; i++) {
+        if (reg->flags[i] & INSTR_RELOC) {
+            const struct reloc_pe *r = get_reloc(reg->base + i, pe);
+            struct section *tsec;
+            dword taddr;
 
-        for (i = relip; i < relip+instr_length; i++) {
-            if (sec->instr_flags[i] & INSTR_RELOC) {
-                const struct reloc_pe *r = get_reloc(i + sec->address, pe);
-                struct section *tsec;
-                dword taddr;
+            if (!r)
+                warn_at("Byte tagged INSTR_RELOC has no reloc; this is a bug.\n");
 
-                if (!r)
-                    warn_at("Byte tagged INSTR_RELOC has no reloc; this is a bug.\n");
+            switch (r->type)
+            {
+            case 3: /* HIGHLOW */
+                if (pe->magic != 0x10b)
+                    warn_at("HIGHLOW relocation in 64-bit image?\n");
+                taddr = read_dword(reg->start + i) - pe->imagebase;
+                tsec = addr2section(taddr, pe);
 
-                switch (r->type)
+                if (!tsec)
                 {
-                case 3: /* HIGHLOW */
-                    if (pe->magic != 0x10b)
-                        warn_at("HIGHLOW relocation in 64-bit image?\n");
-                    taddr = read_dword(sec->offset + i) - pe->imagebase;
-                    tsec = addr2section(taddr, pe);
-
-                    if (!tsec)
-                    {
-                        warn_at("Relocation to %#x isn't in a section?\n", read_dword(sec->offset + i));
-                        continue;
-                    }
-
-                    /* Only try to scan it if it's an immediate address. If someone is
-                     * dereferencing an address inside a code section, it's data. */
-                    if (tsec->flags & 0x20 && (instr.op.arg0 == IMM || instr.op.arg1 == IMM)) {
-                        tsec->instr_flags[taddr - tsec->address] |= INSTR_FUNC;
-                        scan_segment(taddr, pe);
-                    }
-                    break;
-                default:
-                    warn_at("Don't know how to handle relocation type %d\n", r->type);
-                    break;
+                    warn_at("Relocation to %#x isn't in a section?\n", read_dword(reg->start + i));
+                    continue;
+                }
+
+                /* Only try to scan it if it's an immediate address. If someone is
+                 * dereferencing an address inside a code section, it's data. */
+                if (tsec->flags & 0x20 && (instr->op.arg0 == IMM || instr->op.arg1 == IMM)) {
+                    tsec->instr_flags[taddr - tsec->address] |= INSTR_FUNC;
+                    scan_push(taddr);
                 }
                 break;
+            default:
+                warn_at("Don't know how to handle relocation type %d\n", r->type);
+                break;
             }
+            break;
         }
+    }
+}
 
-        if (instr.op.flags & OP_STOP)
-            return;
+static void scan_warn(qword addr, const char *msg, void *ctx) {
+    dword ip = addr;
+    warn_at("%s", msg);
+}
 
-        ip += instr_length;
-        relip = ip - sec->address;
-    }
+static void scan_segment(dword ip, struct pe *pe) {
+    struct scan_format fmt = { scan_resolve, scan_visit, scan_warn,
+        "Scan reached the end of section.\n", pe };
 
-    warn_at("Scan reached the end of section.\n");
+    scan_push(ip);
+    scan_run(&fmt);
 }
 
 static void print_section_flags(dword flags) {
@@ -453,9 +585,18 @@ void read_sections(struct pe *pe) {
     dword entry_point = (pe->magic == 0x10b) ? pe->opt32->AddressOfEntryPoint : pe->opt64->AddressOfEntryPoint;
     int i;
 
+    perf_enter(PERF_SCAN);
+
     /* We already read the section header (unlike NE, we had to in order to read
      * everything else), so our job now is just to scan the section contents. */
 
+    /* The scan hops between branch targets, so pull the code sections in
+     * ahead of it rather than faulting their pages at random. */
+    for (i = 0; i < pe->header->NumberOfSections; i++) {
+        if (pe->sections[i].flags & 0x20)
+            map_advise_willneed(pe->sections[i].offset, pe->sections[i].length);
+    }
+
     /* Relocations first. */
     for (i = 0; i < pe->reloc_count; i++) {
         dword address = pe->relocs[i].offset;
@@ -505,40 +646,102 @@ void read_sections(struct pe *pe) {
             scan_segment(entry_point, pe);
         }
     }
+
+    perf_leave(PERF_SCAN);
 }
 
-void print_sections(struct pe *pe) {
-    int i;
-    struct section *sec;
+static void print_section(struct section *sec, struct pe *pe) {
+    map_advise_willneed(sec->offset, sec->length);
 
-    for (i = 0; i < pe->header->NumberOfSections; i++) {
-        sec = &pe->sections[i];
+    putchar('\n');
+    printf("Section %s (start = 0x%x, length = 0x%x, minimum allocation = 0x%x):\n",
+        sec->name, sec->offset, sec->length, sec->min_alloc);
+    printf("    Address: %x\n", sec->address);
+    print_section_flags(sec->flags);
+
+    /* These fields should only be populated for object files (I think). */
+    if (sec->reloc_offset || sec->reloc_count)
+        warn("Section %s has relocation data: offset = %x, count = %d\n",
+            sec->name, sec->reloc_offset, sec->reloc_count);
+
+    /* Sometimes the .text section is marked as both code and data. I've
+     * seen mingw-w64 do this. (Because there's data stored in it?) */
+    if (sec->flags & 0x20) {
+        if (opts & FULL_CONTENTS)
+            print_data(sec, pe);
+        print_disassembly(sec, pe);
+    } else if (sec->flags & 0x40) {
+        /* see the appropriate FIXMEs on the NE side */
+        /* Don't print .rsrc by default. Some others should probably be
+         * excluded, too, but .rsrc is a particularly bad offender since
+         * large binaries might be put into it. */
+        if ((strcmp(sec->name, ".rsrc") && strcmp(sec->name, ".reloc"))
+            || (opts & FULL_CONTENTS))
+            print_data(sec, pe);
+    }
 
-        putchar('\n');
-        printf("Section %s (start = 0x%x, length = 0x%x, minimum allocation = 0x%x):\n",
-            sec->name, sec->offset, sec->length, sec->min_alloc);
-        printf("    Address: %x\n", sec->address);
-        print_section_flags(sec->flags);
+    /* done with this section's pages; don't let a big input stay resident */
+    map_advise_done(sec->offset, sec->length);
+}
 
-        /* These fields should only be populated for object files (I think). */
-        if (sec->reloc_offset || sec->reloc_count)
-            warn("Section %s has relocation data: offset = %x, count = %d\n",
-                sec->name, sec->reloc_offset, sec->reloc_count);
+/* Formatting a section only reads state the scan pass wrote, so with -j we
+ * can use the same trick dump.c plays with whole files: fork a worker per
+ * section, each writing to an unlinked temporary file, and copy the files
+ * to stdout in section order. (The scan itself stays serial; branches and
+ * relocations routinely cross sections, so the workers would race on each
+ * other's instr_flags.) Workers share stderr, so warnings may interleave. */
+static void print_sections_parallel(struct pe *pe) {
+    int count = pe->header->NumberOfSections;
+    pid_t *pids = malloc(count * sizeof(*pids));
+    FILE **tmps = malloc(count * sizeof(*tmps));
+    char buf[8192];
+    size_t len;
+    int started = 0, done = 0;
+
+    /* make sure buffered output doesn't end up in the workers too */
+    fflush(stdout);
+
+    while (done < count) {
+        while (started < count && started - done < dump_jobs) {
+            pid_t pid;
+
+            if (!(tmps[started] = tmpfile())) {
+                perror("Cannot create temporary file");
+                exit(1);
+            }
 
-        /* Sometimes the .text section is marked as both code and data. I've
-         * seen mingw-w64 do this. (Because there's data stored in it?) */
-        if (sec->flags & 0x20) {
-            if (opts & FULL_CONTENTS)
-                print_data(sec, pe);
-            print_disassembly(sec, pe);
-        } else if (sec->flags & 0x40) {
-            /* see the appropriate FIXMEs on the NE side */
-            /* Don't print .rsrc by default. Some others should probably be
-             * excluded, too, but .rsrc is a particularly bad offender since
-             * large binaries might be put into it. */
-            if ((strcmp(sec->name, ".rsrc") && strcmp(sec->name, ".reloc"))
-                || (opts & FULL_CONTENTS))
-                print_data(sec, pe);
+            if ((pid = fork()) < 0) {
+                perror("Cannot fork");
+                exit(1);
+            } else if (pid == 0) {
+                dup2(fileno(tmps[started]), STDOUT_FILENO);
+                print_section(&pe->sections[started], pe);
+                fflush(stdout);
+                _exit(0);
+            }
+            pids[started++] = pid;
         }
+
+        waitpid(pids[done], NULL, 0);
+        rewind(tmps[done]);
+        while ((len = fread(buf, 1, sizeof(buf), tmps[done])) > 0)
+            fwrite(buf, 1, len, stdout);
+        fclose(tmps[done]);
+        done++;
+    }
+
+    free(pids);
+    free(tmps);
+}
+
+void print_sections(struct pe *pe) {
+    int i;
+
+    if (dump_jobs > 1 && pe->header->NumberOfSections > 1) {
+        print_sections_parallel(pe);
+        return;
     }
+
+    for (i = 0; i < pe->header->NumberOfSections; i++)
+        print_section(&pe->sections[i], pe);
 }
@@ -0,0 +1,82 @@
+/*
+ * Per-phase timing and hot-path counters
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "perf.h"
+
+int perf_stats;
+struct perf_counters perf;
+
+static double phase_start[PERF_PHASE_COUNT];
+static double file_start;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void perf_enter(enum perf_phase phase)
+{
+    if (!perf_stats) return;
+    phase_start[phase] = now();
+}
+
+void perf_leave(enum perf_phase phase)
+{
+    if (!perf_stats) return;
+    perf.phase[phase] += now() - phase_start[phase];
+}
+
+void perf_begin_file(void)
+{
+    if (!perf_stats) return;
+    memset(&perf, 0, sizeof(perf));
+    file_start = now();
+}
+
+/* The phases are disjoint, so parse time is whatever part of the file's
+ * total wasn't spent scanning, resolving or formatting. */
+void perf_report(const char *file)
+{
+    double total, parse;
+
+    if (!perf_stats) return;
+
+    total = now() - file_start;
+    parse = total - perf.phase[PERF_SCAN] - perf.phase[PERF_RESOLVE]
+        - perf.phase[PERF_FORMAT];
+
+    fprintf(stderr, "%s: perf stats:\n", file);
+    fprintf(stderr, "    parse:   %8.2f ms\n", parse * 1000);
+    fprintf(stderr, "    scan:    %8.2f ms\n", perf.phase[PERF_SCAN] * 1000);
+    fprintf(stderr, "    resolve: %8.2f ms\n", perf.phase[PERF_RESOLVE] * 1000);
+    fprintf(stderr, "    format:  %8.2f ms\n", perf.phase[PERF_FORMAT] * 1000);
+    fprintf(stderr, "    total:   %8.2f ms\n", total * 1000);
+    fprintf(stderr, "    %lu instructions decoded, %lu reloc lookups, "
+        "%lu demangle calls, %lu bytes written\n",
+        perf.instrs, perf.reloc_lookups, perf.demangles, perf.bytes_out);
+}
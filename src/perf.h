@@ -0,0 +1,60 @@
+/*
+ * Per-phase timing and hot-path counters
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __PERF_H
+#define __PERF_H
+
+enum perf_phase {
+    PERF_SCAN,      /* code-flow analysis */
+    PERF_RESOLVE,   /* specfile loading */
+    PERF_FORMAT,    /* output formatting */
+    /* parse is whatever is left of the file's total */
+    PERF_PHASE_COUNT
+};
+
+struct perf_counters {
+    unsigned long instrs;           /* instructions decoded */
+    unsigned long reloc_lookups;
+    unsigned long demangles;
+    unsigned long bytes_out;
+    double phase[PERF_PHASE_COUNT];
+};
+
+extern int perf_stats;              /* set by --perf-stats */
+extern struct perf_counters perf;
+
+/* Hot-path counters; a single predictable branch when stats are off, and
+ * compiled out entirely with -DNO_PERF_STATS. */
+#ifdef NO_PERF_STATS
+#define PERF_COUNT(field)   do { } while (0)
+#define PERF_ADD(field, n)  do { } while (0)
+#else
+#define PERF_COUNT(field)   do { if (perf_stats) perf.field++; } while (0)
+#define PERF_ADD(field, n)  do { if (perf_stats) perf.field += (n); } while (0)
+#endif
+
+extern void perf_enter(enum perf_phase phase);
+extern void perf_leave(enum perf_phase phase);
+extern void perf_begin_file(void);
+extern void perf_report(const char *file);
+
+#endif /* __PERF_H */
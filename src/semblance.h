@@ -15,6 +15,16 @@ typedef uint32_t dword;
 typedef uint64_t qword;
 
 byte *map;
+size_t map_length;
+
+/* Nonzero when dump_file() mmapped the input itself; library callers pass
+ * a buffer they own, which must never receive destructive advice. */
+int map_mmapped;
+
+/* Page-cache hints for the mapping; no-ops on a caller-provided buffer. */
+extern void map_advise_sequential(off_t offset, size_t length);
+extern void map_advise_willneed(off_t offset, size_t length);
+extern void map_advise_done(off_t offset, size_t length);
 
 static inline const void *read_data(off_t offset)
 {
@@ -56,6 +66,7 @@ static inline qword read_qword(off_t offset)
 #define DUMPEXPORT      0x04
 #define DUMPIMPORT      0x08
 #define DISASSEMBLE     0x10
+#define EXTRACT_RSRC    0x20
 #define SPECFILE        0x80
 word mode; /* what to dump */
 
@@ -65,6 +76,7 @@ word mode; /* what to dump */
 #define NO_SHOW_ADDRESSES   0x08
 #define COMPILABLE          0x10
 #define FULL_CONTENTS       0x20
+#define STRUCTURED          0x40
 word opts; /* additional options */
 
 enum {
@@ -79,6 +91,12 @@ extern const size_t rsrc_types_count;
 char **resource_filters;
 unsigned resource_filters_count;
 
+/* Base name of the current file, used to name --extract-resource output. */
+const char *extract_basename;
+
+/* Number of parallel jobs (-j). */
+int dump_jobs;
+
 /* Whether to print addresses relative to the image base for PE files. */
 extern int pe_rel_addr;
 
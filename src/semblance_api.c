@@ -0,0 +1,79 @@
+/*
+ * Embeddable entry point for libsemblance
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <unistd.h>
+
+#include "arena.h"
+#include "semblance.h"
+#include "semblance_api.h"
+
+int semblance_dump(const void *buffer, size_t size, FILE *output,
+    const struct semblance_options *options)
+{
+    int saved_stdout = -1;
+    word magic;
+    long offset;
+    int ret = 0;
+
+    map = (byte *)buffer;
+    map_length = size;
+    map_mmapped = 0;
+    mode = options->mode ? options->mode : (~0 & ~EXTRACT_RSRC);
+    opts = options->opts;
+    asm_syntax = options->syntax;
+    pe_rel_addr = options->pe_rel_addr;
+
+    /* The printers all write to stdout; point it at the caller's sink for
+     * the duration of the call. */
+    if (output != stdout) {
+        fflush(stdout);
+        fflush(output);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(fileno(output), STDOUT_FILENO);
+    }
+
+    magic = read_word(0);
+    if (magic == 0x5a4d) { /* MZ */
+        /* Don't chase e_lfanew into code or past the end of a plain DOS
+         * executable; the field only exists in NE/PE-era headers. */
+        offset = (size >= 0x40) ? read_dword(0x3c) : 0;
+        magic = (offset >= 0x40 && offset + 2 <= (long)size) ? read_word(offset) : 0;
+
+        if (magic == 0x4550)
+            dumppe(offset);
+        else if (magic == 0x454e)
+            dumpne(offset);
+        else
+            dumpmz();
+    } else
+        ret = -1;
+
+    arena_reset();
+
+    if (saved_stdout >= 0) {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    return ret;
+}
@@ -0,0 +1,68 @@
+/*
+ * Embeddable entry point for libsemblance
+ *
+ * Copyright 2017-2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef SEMBLANCE_API_H
+#define SEMBLANCE_API_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* What to dump; same bits as semblance.h. Zero means everything. */
+#define SEMBLANCE_DUMPHEADER    0x01
+#define SEMBLANCE_DUMPRSRC      0x02
+#define SEMBLANCE_DUMPEXPORT    0x04
+#define SEMBLANCE_DUMPIMPORT    0x08
+#define SEMBLANCE_DISASSEMBLE   0x10
+
+/* Additional options; same bits as semblance.h. */
+#define SEMBLANCE_DISASSEMBLE_ALL   0x01
+#define SEMBLANCE_DEMANGLE          0x02
+#define SEMBLANCE_NO_SHOW_RAW_INSN  0x04
+#define SEMBLANCE_NO_SHOW_ADDRESSES 0x08
+#define SEMBLANCE_COMPILABLE        0x10
+#define SEMBLANCE_FULL_CONTENTS     0x20
+#define SEMBLANCE_STRUCTURED        0x40
+
+enum semblance_syntax {
+    SEMBLANCE_GAS,
+    SEMBLANCE_NASM,
+    SEMBLANCE_MASM,
+};
+
+struct semblance_options {
+    uint16_t mode;              /* SEMBLANCE_DUMP* bits; 0 dumps everything */
+    uint16_t opts;              /* SEMBLANCE_* option bits */
+    enum semblance_syntax syntax;
+    int pe_rel_addr;            /* 1, 0, or -1 for the per-file default */
+};
+
+/* Dump one in-memory executable image to `output'. Returns 0 on success and
+ * -1 if the buffer isn't an MZ/NE/PE image.
+ *
+ * The engine underneath still keeps its per-file state in globals, so this
+ * is safe to call back-to-back from one thread (the per-file arena is
+ * recycled between calls) but not from several threads at once; a host that
+ * wants parallelism should use one process per worker, as dump -j does. */
+int semblance_dump(const void *buffer, size_t size, FILE *output,
+    const struct semblance_options *options);
+
+#endif /* SEMBLANCE_API_H */
@@ -21,6 +21,8 @@
  */
 
 #include <string.h>
+#include "output.h"
+#include "perf.h"
 #include "x86_instr.h"
 
 /* this is easier than doing bitfields */
@@ -992,10 +994,23 @@ static const struct op instructions_fpu_single[] = {
     {0xDF, 0xE0, 0, "fnstsw", AX},
 };
 
+/* Direct-dispatch tables over the op lists in this file, built once on the
+ * first call to get_instr(). Decoding an escape, SSE or group opcode is then
+ * a single lookup indexed by opcode byte and subcode instead of a scan over
+ * the whole list. A NULL entry means no such instruction. */
+static const struct op *dispatch_group[256][8];
+static const struct op *dispatch_0F[256][8];
+static const struct op *dispatch_sse[256][8];
+static const struct op *dispatch_sse_op32[256][8];
+static const struct op *dispatch_sse_repne[256][8];
+static const struct op *dispatch_sse_repe[256][8];
+static const struct op *dispatch_sse_single[2][256];        /* [opcode == 0x3A] */
+static const struct op *dispatch_sse_single_op32[2][256];
+static const struct op *dispatch_fpu_single[8][256];
+
 static int get_fpu_instr(const byte *p, struct op *op) {
     byte subcode = REGOF(p[1]);
     byte index = (p[0] & 7)*8 + subcode;
-    unsigned i;
 
     if (MODOF(p[1]) < 3) {
         if (instructions_fpu_m[index].name[0])
@@ -1006,14 +1021,9 @@ static int get_fpu_instr(const byte *p, struct op *op) {
             *op = instructions_fpu_r[index];
             return 0;
         } else {
-            /* try the single op list */
-            for (i=0; i<sizeof(instructions_fpu_single)/sizeof(struct op); i++) {
-                if (p[0] == instructions_fpu_single[i].opcode &&
-                    p[1] == instructions_fpu_single[i].subcode) {
-                    *op = instructions_fpu_single[i];
-                    break;
-                }
-            }
+            /* try the single op table */
+            if (dispatch_fpu_single[p[0] & 7][p[1]])
+                *op = *dispatch_fpu_single[p[0] & 7][p[1]];
         }
         return 1;
     }
@@ -1452,6 +1462,43 @@ static const struct op instructions_sse_single_op32[] = {
     {0x3A, 0x63, 0, "pcmpistri",    XMM,    XM,     OP_ARG2_IMM8},
 };
 
+static void index_op_list(const struct op *list, unsigned count,
+    const struct op *(*table)[8]) {
+    unsigned i, s;
+
+    for (i = 0; i < count; i++) {
+        if (list[i].subcode == 8) {
+            /* all subcodes; don't overwrite more specific entries */
+            for (s = 0; s < 8; s++)
+                if (!table[list[i].opcode][s])
+                    table[list[i].opcode][s] = &list[i];
+        } else
+            table[list[i].opcode][list[i].subcode] = &list[i];
+    }
+}
+
+static void build_dispatch_tables(void) {
+    unsigned i;
+
+    index_op_list(instructions_group, sizeof(instructions_group)/sizeof(struct op), dispatch_group);
+    index_op_list(instructions_0F, sizeof(instructions_0F)/sizeof(struct op), dispatch_0F);
+    index_op_list(instructions_sse, sizeof(instructions_sse)/sizeof(struct op), dispatch_sse);
+    index_op_list(instructions_sse_op32, sizeof(instructions_sse_op32)/sizeof(struct op), dispatch_sse_op32);
+    index_op_list(instructions_sse_repne, sizeof(instructions_sse_repne)/sizeof(struct op), dispatch_sse_repne);
+    index_op_list(instructions_sse_repe, sizeof(instructions_sse_repe)/sizeof(struct op), dispatch_sse_repe);
+
+    /* the three-byte and single-op lists key on the full second byte */
+    for (i = 0; i < sizeof(instructions_sse_single)/sizeof(struct op); i++)
+        dispatch_sse_single[instructions_sse_single[i].opcode == 0x3A]
+            [instructions_sse_single[i].subcode] = &instructions_sse_single[i];
+    for (i = 0; i < sizeof(instructions_sse_single_op32)/sizeof(struct op); i++)
+        dispatch_sse_single_op32[instructions_sse_single_op32[i].opcode == 0x3A]
+            [instructions_sse_single_op32[i].subcode] = &instructions_sse_single_op32[i];
+    for (i = 0; i < sizeof(instructions_fpu_single)/sizeof(struct op); i++)
+        dispatch_fpu_single[instructions_fpu_single[i].opcode & 7]
+            [instructions_fpu_single[i].subcode] = &instructions_fpu_single[i];
+}
+
 /* returns the flag if it's a prefix, 0 otherwise */
 static word get_prefix(word opcode, int bits) {
     if (bits == 64) {
@@ -1476,30 +1523,23 @@ static word get_prefix(word opcode, int bits) {
     }
 }
 
-static int instr_matches(const byte opcode, const byte subcode, const struct op *op) {
-    return ((opcode == op->opcode) && ((op->subcode == 8) || (subcode == op->subcode)));
-}
-
 /* aka 3 byte opcode */
 static int get_sse_single(byte opcode, byte subcode, struct instr *instr) {
-    int i;
+    const struct op *op;
+
+    if (opcode != 0x38 && opcode != 0x3A)
+        return 0;
 
     if (instr->prefix & PREFIX_OP32) {
-        for (i = 0; i < sizeof(instructions_sse_single_op32)/sizeof(struct op); i++) {
-            if (instructions_sse_single_op32[i].opcode == opcode &&
-                instructions_sse_single_op32[i].subcode == subcode) {
-                instr->op = instructions_sse_single_op32[i];
-                instr->prefix &= ~PREFIX_OP32;
-                return 1;
-            }
+        if ((op = dispatch_sse_single_op32[opcode == 0x3A][subcode])) {
+            instr->op = *op;
+            instr->prefix &= ~PREFIX_OP32;
+            return 1;
         }
     } else {
-        for (i = 0; i < sizeof(instructions_sse_single)/sizeof(struct op); i++) {
-            if (instructions_sse_single[i].opcode == opcode &&
-                instructions_sse_single[i].subcode == subcode) {
-                instr->op = instructions_sse_single[i];
-                return 1;
-            }
+        if ((op = dispatch_sse_single[opcode == 0x3A][subcode])) {
+            instr->op = *op;
+            return 1;
         }
     }
 
@@ -1508,42 +1548,34 @@ static int get_sse_single(byte opcode, byte subcode, struct instr *instr) {
 
 static int get_sse_instr(const byte *p, struct instr *instr) {
     byte subcode = REGOF(p[1]);
-    unsigned i;
+    const struct op *op;
 
     /* Clear the prefix if it matches. This makes the disassembler work right,
      * but it might break things later if we want to interpret these. The
      * solution in that case is probably to modify the size/name instead. */
 
     if (instr->prefix & PREFIX_OP32) {
-        for (i = 0; i < sizeof(instructions_sse_op32)/sizeof(struct op); i++) {
-            if (instr_matches(p[0], subcode, &instructions_sse_op32[i])) {
-                instr->op = instructions_sse_op32[i];
-                instr->prefix &= ~PREFIX_OP32;
-                return 0;
-            }
+        if ((op = dispatch_sse_op32[p[0]][subcode])) {
+            instr->op = *op;
+            instr->prefix &= ~PREFIX_OP32;
+            return 0;
         }
     } else if (instr->prefix & PREFIX_REPNE) {
-        for (i = 0; i < sizeof(instructions_sse_repne)/sizeof(struct op); i++) {
-            if (instr_matches(p[0], subcode, &instructions_sse_repne[i])) {
-                instr->op = instructions_sse_repne[i];
-                instr->prefix &= ~PREFIX_REPNE;
-                return 0;
-            }
+        if ((op = dispatch_sse_repne[p[0]][subcode])) {
+            instr->op = *op;
+            instr->prefix &= ~PREFIX_REPNE;
+            return 0;
         }
     } else if (instr->prefix & PREFIX_REPE) {
-        for (i = 0; i < sizeof(instructions_sse_repe)/sizeof(struct op); i++) {
-            if (instr_matches(p[0], subcode, &instructions_sse_repe[i])) {
-                instr->op = instructions_sse_repe[i];
-                instr->prefix &= ~PREFIX_REPE;
-                return 0;
-            }
+        if ((op = dispatch_sse_repe[p[0]][subcode])) {
+            instr->op = *op;
+            instr->prefix &= ~PREFIX_REPE;
+            return 0;
         }
     } else {
-        for (i = 0; i < sizeof(instructions_sse)/sizeof(struct op); i++) {
-            if (instr_matches(p[0], subcode, &instructions_sse[i])) {
-                instr->op = instructions_sse[i];
-                return 0;
-            }
+        if ((op = dispatch_sse[p[0]][subcode])) {
+            instr->op = *op;
+            return 0;
         }
     }
 
@@ -1552,7 +1584,7 @@ static int get_sse_instr(const byte *p, struct instr *instr) {
 
 static int get_0f_instr(const byte *p, struct instr *instr) {
     byte subcode = REGOF(p[1]);
-    unsigned i;
+    const struct op *op;
     int len;
 
     /* a couple of special (read: annoying) cases first */
@@ -1580,12 +1612,9 @@ static int get_0f_instr(const byte *p, struct instr *instr) {
         return 1;
     }
 
-    for (i = 0; i < sizeof(instructions_0F)/sizeof(struct op); i++) {
-        if (instr_matches(p[0], subcode, &instructions_0F[i])) {
-            instr->op = instructions_0F[i];
-            len = 0;
-            break;
-        }
+    if ((op = dispatch_0F[p[0]][subcode])) {
+        instr->op = *op;
+        len = 0;
     }
     if (!instr->op.name[0])
         len = get_sse_instr(p, instr);
@@ -1614,7 +1643,7 @@ static int get_0f_instr(const byte *p, struct instr *instr) {
  * Does not process specific arguments (e.g. registers, DSBX, ONE...)
  * The parameter out is given as a dword but may require additional casting.
  */
-static int get_arg(dword ip, const byte *p, struct arg *arg, struct instr *instr, int bits) {
+static inline int __attribute__((always_inline)) get_arg(dword ip, const byte *p, struct arg *arg, struct instr *instr, const int bits) {
     arg->value = 0;
 
     switch (arg->type) {
@@ -1795,43 +1824,95 @@ static const char reg64[17][4] = {
     "rax","rcx","rdx","rbx","rsp","rbp","rsi","rdi","r8","r9","r10","r11","r12","r13","r14","r15","rip"
 };
 
-static void get_seg16(char *out, byte reg) {
-    if (asm_syntax == GAS)
-        strcat(out, "%");
-    strcat(out, seg16[reg]);
+/* Append kernels for argument rendering. Formatting is about half of the
+ * disassembly profile and none of it needs printf generality: everything we
+ * emit is a literal, a register name, or a zero-padded hex number. Each
+ * kernel appends at `out', keeps the string terminated, and returns the new
+ * end so the callers can carry a cursor instead of calling strlen. */
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+/* Everything about a syntax that amounts to "print this string here" lives
+ * in one table, selected once per instruction instead of a ternary on
+ * asm_syntax in every formatting expression. GAS prints lowercase hex; see
+ * the note on capitals above print_arg(). */
+struct syntax_info {
+    const char *hex_digits;             /* alphabet for cat_hex */
+    const char *reg_prefix;             /* "%" for GAS */
+    const char *imm_prefix;             /* "$0x" for GAS */
+    const char *imm_suffix;             /* "h" for MASM/NASM */
+    const char *kw_word, *kw_dword, *kw_qword;  /* immediate size keywords */
+    const char *mem_open, *mem_close;
+};
+
+static const struct syntax_info syntax_info[] = {
+    [GAS]  = { hex_lower, "%", "$0x", "",  "",      "",       "",       "(", ")" },
+    [NASM] = { hex_upper, "",  "",    "h", "word ", "dword ", "qword ", "[", "]" },
+    [MASM] = { hex_upper, "",  "",    "h", "word ", "dword ", "qword ", "[", "]" },
+};
+
+static const struct syntax_info *syn = &syntax_info[NASM];
+
+static char *cat_str(char *out, const char *str) {
+    while ((*out = *str++))
+        out++;
+    return out;
 }
 
-static void get_reg8(char *out, byte reg, int rex) {
-    if (asm_syntax == GAS)
-        strcat(out, "%");
-    strcat(out, rex ? reg8_rex[reg] : reg8[reg]);
+/* zero-padded to at least `digits', wider if the value demands it */
+static char *cat_hex(char *out, qword value, int digits, const char *alphabet) {
+    qword v = value;
+    int n = 1, i;
+
+    while (v >>= 4)
+        n++;
+    if (n < digits)
+        n = digits;
+
+    for (i = n - 1; i >= 0; i--) {
+        out[i] = alphabet[value & 0xf];
+        value >>= 4;
+    }
+    out[n] = 0;
+    return out + n;
+}
+
+static char *get_seg16(char *out, byte reg) {
+    out = cat_str(out, syn->reg_prefix);
+    return cat_str(out, seg16[reg]);
 }
 
-static void get_reg16(char *out, byte reg, int size) {
+static char *get_reg8(char *out, byte reg, int rex) {
+    out = cat_str(out, syn->reg_prefix);
+    return cat_str(out, rex ? reg8_rex[reg] : reg8[reg]);
+}
+
+static char *get_reg16(char *out, byte reg, int size) {
     if (reg != -1) {
-        if (asm_syntax == GAS)
-            strcat(out, "%");
+        out = cat_str(out, syn->reg_prefix);
         if (size == 16)
-            strcat(out, reg16[reg]);
+            out = cat_str(out, reg16[reg]);
         if (size == 32)
-            strcat(out, reg32[reg]);
+            out = cat_str(out, reg32[reg]);
         else if (size == 64)
-            strcat(out, reg64[reg]);
+            out = cat_str(out, reg64[reg]);
     }
+    return out;
 }
 
-static void get_xmm(char *out, byte reg) {
-    if (asm_syntax == GAS)
-        strcat(out, "%");
-    strcat(out, "xmm0");
-    out[strlen(out)-1] = '0'+reg;
+static char *get_xmm(char *out, byte reg) {
+    out = cat_str(out, syn->reg_prefix);
+    out = cat_str(out, "xmm0");
+    out[-1] = '0'+reg;
+    return out;
 }
 
-static void get_mmx(char *out, byte reg) {
-    if (asm_syntax == GAS)
-        strcat(out, "%");
-    strcat(out, "mm0");
-    out[strlen(out)-1] = '0'+reg;
+static char *get_mmx(char *out, byte reg) {
+    out = cat_str(out, syn->reg_prefix);
+    out = cat_str(out, "mm0");
+    out[-1] = '0'+reg;
+    return out;
 }
 
 static const char modrm16_gas[8][8] = {
@@ -1866,52 +1947,72 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
     if (arg->string[0]) return; /* someone wants to print something special */
 
     if (arg->type >= AL && arg->type <= BH)
-        get_reg8(out, arg->type-AL, 0);
+        out = get_reg8(out, arg->type-AL, 0);
     else if (arg->type >= AX && arg->type <= DI)
-        get_reg16(out, arg->type-AX + ((instr->prefix & PREFIX_REXB) ? 8 : 0), instr->op.size);
+        out = get_reg16(out, arg->type-AX + ((instr->prefix & PREFIX_REXB) ? 8 : 0), instr->op.size);
     else if (arg->type >= ES && arg->type <= GS)
-        get_seg16(out, arg->type-ES);
+        out = get_seg16(out, arg->type-ES);
 
     switch (arg->type) {
     case ONE:
-        strcat(out, (asm_syntax == GAS) ? "$0x1" : "1h");
+        out = cat_str(out, syn->imm_prefix);
+        out = cat_str(out, "1");
+        out = cat_str(out, syn->imm_suffix);
         break;
     case IMM8:
         if (instr->op.flags & OP_STACK) { /* 6a */
-            if (instr->op.size == 64)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%016lx" : "qword %016lxh", (qword) (int8_t) value);
-            else if (instr->op.size == 32)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%08x" : "dword %08Xh", (dword) (int8_t) value);
-            else
-                sprintf(out, (asm_syntax == GAS) ? "$0x%04x" : "word %04Xh", (word) (int8_t) value);
-        } else
-            sprintf(out, (asm_syntax == GAS) ? "$0x%02lx" : "%02lXh", value);
+            if (instr->op.size == 64) {
+                out = cat_str(out, syn->imm_prefix);
+                out = cat_str(out, syn->kw_qword);
+                out = cat_hex(out, (qword) (int8_t) value, 16, hex_lower);
+            } else if (instr->op.size == 32) {
+                out = cat_str(out, syn->imm_prefix);
+                out = cat_str(out, syn->kw_dword);
+                out = cat_hex(out, (dword) (int8_t) value, 8, syn->hex_digits);
+            } else {
+                out = cat_str(out, syn->imm_prefix);
+                out = cat_str(out, syn->kw_word);
+                out = cat_hex(out, (word) (int8_t) value, 4, syn->hex_digits);
+            }
+        } else {
+            out = cat_str(out, syn->imm_prefix);
+            out = cat_hex(out, value, 2, syn->hex_digits);
+        }
+        out = cat_str(out, syn->imm_suffix);
         break;
     case IMM16:
-        sprintf(out, (asm_syntax == GAS) ? "$0x%04lx" : "%04lXh", value);
+        out = cat_str(out, syn->imm_prefix);
+        out = cat_hex(out, value, 4, syn->hex_digits);
+        out = cat_str(out, syn->imm_suffix);
         break;
     case IMM:
+        out = cat_str(out, syn->imm_prefix);
         if (instr->op.flags & OP_STACK) {
-            if (instr->op.size == 64)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%016lx" : "qword %016lXh", value);
-            else if (instr->op.size == 32)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%08lx" : "dword %08lXh", value);
-            else
-                sprintf(out, (asm_syntax == GAS) ? "$0x%04lx" : "word %04lXh", value);
+            if (instr->op.size == 64) {
+                out = cat_str(out, syn->kw_qword);
+                out = cat_hex(out, value, 16, syn->hex_digits);
+            } else if (instr->op.size == 32) {
+                out = cat_str(out, syn->kw_dword);
+                out = cat_hex(out, value, 8, syn->hex_digits);
+            } else {
+                out = cat_str(out, syn->kw_word);
+                out = cat_hex(out, value, 4, syn->hex_digits);
+            }
         } else {
             if (instr->op.size == 8)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%02lx" : "%02lXh", value);
+                out = cat_hex(out, value, 2, syn->hex_digits);
             else if (instr->op.size == 16)
-                sprintf(out, (asm_syntax == GAS) ? "$0x%04lx" : "%04lXh", value);
+                out = cat_hex(out, value, 4, syn->hex_digits);
             else if (instr->op.size == 64 && (instr->op.flags & OP_IMM64))
-                sprintf(out, (asm_syntax == GAS) ? "$0x%016lx" : "%016lXh", value);
+                out = cat_hex(out, value, 16, syn->hex_digits);
             else
-                sprintf(out, (asm_syntax == GAS) ? "$0x%08lx" : "%08lXh", value);
+                out = cat_hex(out, value, 8, syn->hex_digits);
         }
+        out = cat_str(out, syn->imm_suffix);
         break;
     case REL8:
     case REL16:
-        sprintf(out, "%04lx", value);
+        out = cat_hex(out, value, 4, hex_lower);
         break;
     case PTR32:
         /* should always be relocated */
@@ -1919,17 +2020,19 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
     case MOFFS16:
         if (asm_syntax == GAS) {
             if (instr->prefix & PREFIX_SEG_MASK) {
-                get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
-                strcat(out, ":");
+                out = get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
+                out = cat_str(out, ":");
             }
-            sprintf(out+strlen(out), "0x%04lx", value);
+            out = cat_str(out, "0x");
+            out = cat_hex(out, value, 4, hex_lower);
         } else {
-            out[0] = '[';
+            out = cat_str(out, "[");
             if (instr->prefix & PREFIX_SEG_MASK) {
-                get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
-                strcat(out, ":");
+                out = get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
+                out = cat_str(out, ":");
             }
-            sprintf(out+strlen(out), "%04lXh]", value);
+            out = cat_hex(out, value, 4, hex_upper);
+            out = cat_str(out, "h]");
         }
         instr->usedmem = 1;
         break;
@@ -1937,36 +2040,38 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
     case DSSI:
         if (asm_syntax != NASM) {
             if (instr->prefix & PREFIX_SEG_MASK) {
-                get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
-                strcat(out, ":");
+                out = get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
+                out = cat_str(out, ":");
             }
-            strcat(out, (asm_syntax == GAS) ? "(" : "[");
-            get_reg16(out, (arg->type == DSBX) ? 3 : 6, instr->addrsize);
-            strcat(out, (asm_syntax == GAS) ? ")" : "]");
+            out = cat_str(out, syn->mem_open);
+            out = get_reg16(out, (arg->type == DSBX) ? 3 : 6, instr->addrsize);
+            out = cat_str(out, syn->mem_close);
         }
         instr->usedmem = 1;
         break;
     case ESDI:
         if (asm_syntax != NASM) {
-            strcat(out, (asm_syntax == GAS) ? "%es:(" : "es:[");
-            get_reg16(out, 7, instr->addrsize);
-            strcat(out, (asm_syntax == GAS) ? ")" : "]");
+            out = cat_str(out, syn->reg_prefix);
+            out = cat_str(out, "es:");
+            out = cat_str(out, syn->mem_open);
+            out = get_reg16(out, 7, instr->addrsize);
+            out = cat_str(out, syn->mem_close);
         }
         instr->usedmem = 1;
         break;
     case ALS:
         if (asm_syntax == GAS)
-            strcpy(out, "%al");
+            out = cat_str(out, "%al");
         break;
     case AXS:
         if (asm_syntax == GAS)
-            strcpy(out, "%ax");
+            out = cat_str(out, "%ax");
         break;
     case DXS:
         if (asm_syntax == GAS)
-            strcpy(out, "(%dx)");
+            out = cat_str(out, "(%dx)");
         else
-            strcpy(out, "dx");
+            out = cat_str(out, "dx");
         break;
     /* register/memory. this is always the first byte after the opcode,
      * and is always either paired with a simple register or a subcode.
@@ -1980,7 +2085,7 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
             if (arg->type == XM) {
                 get_xmm(out, instr->modrm_reg);
                 if (instr->vex_256)
-                    out[asm_syntax == GAS ? 1 : 0] = 'y';
+                    arg->string[asm_syntax == GAS ? 1 : 0] = 'y';
                 break;
             } else if (arg->type == MM) {
                 get_mmx(out, instr->modrm_reg);
@@ -2007,131 +2112,154 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
 
         if (asm_syntax == GAS) {
             if (instr->op.opcode == 0xFF && instr->op.subcode >= 2 && instr->op.subcode <= 5)
-                strcat(out, "*");
+                out = cat_str(out, "*");
 
             if (instr->prefix & PREFIX_SEG_MASK) {
-                get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
-                strcat(out, ":");
+                out = get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
+                out = cat_str(out, ":");
             }
 
             /* offset */
             if (instr->modrm_disp == DISP_8) {
                 int8_t svalue = (int8_t) value;
-                if (svalue < 0)
-                    sprintf(out+strlen(out), "-0x%02x", -svalue);
-                else
-                    sprintf(out+strlen(out), "0x%02x", svalue);
+                if (svalue < 0) {
+                    out = cat_str(out, "-0x");
+                    out = cat_hex(out, -svalue, 2, hex_lower);
+                } else {
+                    out = cat_str(out, "0x");
+                    out = cat_hex(out, svalue, 2, hex_lower);
+                }
             } else if (instr->modrm_disp == DISP_16 && instr->addrsize == 16) {
                 int16_t svalue = (int16_t) value;
                 if (instr->modrm_reg == -1) {
-                    sprintf(out+strlen(out), "0x%04lx", value);  /* absolute memory is unsigned */
+                    out = cat_str(out, "0x");
+                    cat_hex(out, value, 4, hex_lower); /* absolute memory is unsigned */
                     return;
                 }
-                if (svalue < 0)
-                    sprintf(out+strlen(out), "-0x%04x", -svalue);
-                else
-                    sprintf(out+strlen(out), "0x%04x", svalue);
+                if (svalue < 0) {
+                    out = cat_str(out, "-0x");
+                    out = cat_hex(out, -svalue, 4, hex_lower);
+                } else {
+                    out = cat_str(out, "0x");
+                    out = cat_hex(out, svalue, 4, hex_lower);
+                }
             } else if (instr->modrm_disp == DISP_16) {
                 int32_t svalue = (int32_t) value;
                 if (instr->modrm_reg == -1) {
-                    sprintf(out+strlen(out), "0x%08lx", value);  /* absolute memory is unsigned */
+                    out = cat_str(out, "0x");
+                    cat_hex(out, value, 8, hex_lower); /* absolute memory is unsigned */
                     return;
                 }
-                if (svalue < 0)
-                    sprintf(out+strlen(out), "-0x%08x", -svalue);
-                else
-                    sprintf(out+strlen(out), "0x%08x", svalue);
+                if (svalue < 0) {
+                    out = cat_str(out, "-0x");
+                    out = cat_hex(out, (dword) -svalue, 8, hex_lower);
+                } else {
+                    out = cat_str(out, "0x");
+                    out = cat_hex(out, svalue, 8, hex_lower);
+                }
             }
 
-            strcat(out, "(");
+            out = cat_str(out, "(");
 
             if (instr->addrsize == 16) {
-                strcat(out, modrm16_gas[instr->modrm_reg]);
+                out = cat_str(out, modrm16_gas[instr->modrm_reg]);
             } else {
-                get_reg16(out, instr->modrm_reg, instr->addrsize);
+                out = get_reg16(out, instr->modrm_reg, instr->addrsize);
                 if (instr->sib_scale && instr->sib_index != -1) {
-                    strcat(out, ",");
-                    get_reg16(out, instr->sib_index, instr->addrsize);
-                    strcat(out, ",0");
-                    out[strlen(out)-1] = '0'+instr->sib_scale;
+                    out = cat_str(out, ",");
+                    out = get_reg16(out, instr->sib_index, instr->addrsize);
+                    out = cat_str(out, ",0");
+                    out[-1] = '0'+instr->sib_scale;
                 }
             }
-            strcat(out, ")");
+            out = cat_str(out, ")");
         } else {
             int has_sib = (instr->sib_scale != 0 && instr->sib_index != -1);
             if (instr->op.flags & OP_FAR)
-                strcat(out, "far ");
+                out = cat_str(out, "far ");
             else if (!is_reg(instr->op.arg0) && !is_reg(instr->op.arg1)) {
                 switch (instr->op.size) {
-                case  8: strcat(out, "byte "); break;
-                case 16: strcat(out, "word "); break;
-                case 32: strcat(out, "dword "); break;
-                case 64: strcat(out, "qword "); break;
-                case 80: strcat(out, "tword "); break;
+                case  8: out = cat_str(out, "byte "); break;
+                case 16: out = cat_str(out, "word "); break;
+                case 32: out = cat_str(out, "dword "); break;
+                case 64: out = cat_str(out, "qword "); break;
+                case 80: out = cat_str(out, "tword "); break;
                 default: break;
                 }
                 if (asm_syntax == MASM) /* && instr->op.size == 0? */
-                    strcat(out, "ptr ");
+                    out = cat_str(out, "ptr ");
             } else if (instr->op.opcode == 0x0FB6 || instr->op.opcode == 0x0FBE) { /* mov*b* */
-                strcat(out,"byte ");
+                out = cat_str(out, "byte ");
                 if (asm_syntax == MASM)
-                    strcat(out, "ptr ");
+                    out = cat_str(out, "ptr ");
             } else if (instr->op.opcode == 0x0FB7 || instr->op.opcode == 0x0FBF) { /* mov*w* */
-                strcat(out,"word ");
+                out = cat_str(out, "word ");
                 if (asm_syntax == MASM)
-                    strcat(out, "ptr ");
+                    out = cat_str(out, "ptr ");
             }
 
             if (asm_syntax == NASM)
-                strcat(out, "[");
+                out = cat_str(out, "[");
 
             if (instr->prefix & PREFIX_SEG_MASK) {
-                get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
-                strcat(out, ":");
+                out = get_seg16(out, (instr->prefix & PREFIX_SEG_MASK)-1);
+                out = cat_str(out, ":");
             }
 
             if (asm_syntax == MASM)
-                strcat(out, "[");
+                out = cat_str(out, "[");
 
             if (instr->modrm_reg != -1) {
                 if (instr->addrsize == 16)
-                    strcat(out, modrm16_masm[instr->modrm_reg]);
+                    out = cat_str(out, modrm16_masm[instr->modrm_reg]);
                 else
-                    get_reg16(out, instr->modrm_reg, instr->addrsize);
+                    out = get_reg16(out, instr->modrm_reg, instr->addrsize);
                 if (has_sib)
-                    strcat(out, "+");
+                    out = cat_str(out, "+");
             }
 
             if (has_sib) {
-                get_reg16(out, instr->sib_index, instr->addrsize);
-                strcat(out, "*0");
-                out[strlen(out)-1] = '0'+instr->sib_scale;
+                out = get_reg16(out, instr->sib_index, instr->addrsize);
+                out = cat_str(out, "*0");
+                out[-1] = '0'+instr->sib_scale;
             }
 
             if (instr->modrm_disp == DISP_8) {
                 int8_t svalue = (int8_t) value;
-                if (svalue < 0)
-                    sprintf(out+strlen(out), "-%02Xh", -svalue);
-                else
-                    sprintf(out+strlen(out), "+%02Xh", svalue);
+                if (svalue < 0) {
+                    out = cat_str(out, "-");
+                    out = cat_hex(out, -svalue, 2, hex_upper);
+                } else {
+                    out = cat_str(out, "+");
+                    out = cat_hex(out, svalue, 2, hex_upper);
+                }
+                out = cat_str(out, "h");
             } else if (instr->modrm_disp == DISP_16 && instr->addrsize == 16) {
                 int16_t svalue = (int16_t) value;
                 if (instr->modrm_reg == -1 && !has_sib)
-                    sprintf(out+strlen(out), "%04lXh", value);   /* absolute memory is unsigned */
-                else if (svalue < 0)
-                    sprintf(out+strlen(out), "-%04Xh", -svalue);
-                else
-                    sprintf(out+strlen(out), "+%04Xh", svalue);
+                    out = cat_hex(out, value, 4, hex_upper); /* absolute memory is unsigned */
+                else if (svalue < 0) {
+                    out = cat_str(out, "-");
+                    out = cat_hex(out, -svalue, 4, hex_upper);
+                } else {
+                    out = cat_str(out, "+");
+                    out = cat_hex(out, svalue, 4, hex_upper);
+                }
+                out = cat_str(out, "h");
             } else if (instr->modrm_disp == DISP_16) {
                 int32_t svalue = (int32_t) value;
                 if (instr->modrm_reg == -1 && !has_sib)
-                    sprintf(out+strlen(out), "%08lXh", value);   /* absolute memory is unsigned */
-                else if (svalue < 0)
-                    sprintf(out+strlen(out), "-%08Xh", -svalue);
-                else
-                    sprintf(out+strlen(out), "+%08Xh", svalue);
+                    out = cat_hex(out, value, 8, hex_upper); /* absolute memory is unsigned */
+                else if (svalue < 0) {
+                    out = cat_str(out, "-");
+                    out = cat_hex(out, (dword) -svalue, 8, hex_upper);
+                } else {
+                    out = cat_str(out, "+");
+                    out = cat_hex(out, svalue, 8, hex_upper);
+                }
+                out = cat_str(out, "h");
             }
-            strcat(out, "]");
+            out = cat_str(out, "]");
         }
         break;
     case REG:
@@ -2163,42 +2291,37 @@ static void print_arg(char *ip, struct instr *instr, int i, int bits) {
             warn_at("Invalid control register %ld\n", value);
             break;
         }
-        if (asm_syntax == GAS)
-            strcat(out, "%");
-        strcat(out, "cr0");
-        out[strlen(out)-1] = '0'+value;
+        out = cat_str(out, syn->reg_prefix);
+        out = cat_str(out, "cr0");
+        out[-1] = '0'+value;
         break;
     case DR32:
-        if (asm_syntax == GAS)
-            strcat(out, "%");
-        strcat(out, "dr0");
-        out[strlen(out)-1] = '0'+value;
+        out = cat_str(out, syn->reg_prefix);
+        out = cat_str(out, "dr0");
+        out[-1] = '0'+value;
         break;
     case TR32:
         if (value < 3)
             warn_at("Invalid test register %ld\n", value);
-        if (asm_syntax == GAS)
-            strcat(out, "%");
-        strcat(out, "tr0");
-        out[strlen(out)-1] = '0'+value;
+        out = cat_str(out, syn->reg_prefix);
+        out = cat_str(out, "tr0");
+        out[-1] = '0'+value;
         break;
     case ST:
-        if (asm_syntax == GAS)
-            strcat(out, "%");
-        strcat(out, "st");
+        out = cat_str(out, syn->reg_prefix);
+        out = cat_str(out, "st");
         if (asm_syntax == NASM)
-            strcat(out, "0");
+            out = cat_str(out, "0");
         break;
     case STX:
-        if (asm_syntax == GAS)
-            strcat(out, "%");
-        strcat(out, "st");
+        out = cat_str(out, syn->reg_prefix);
+        out = cat_str(out, "st");
         if (asm_syntax != NASM)
-            strcat(out, "(");
-        strcat(out, "0");
-        out[strlen(out)-1] = '0' + value;
+            out = cat_str(out, "(");
+        out = cat_str(out, "0");
+        out[-1] = '0' + value;
         if (asm_syntax != NASM)
-            strcat(out, ")");
+            out = cat_str(out, ")");
         break;
     case MMX:
     case MMXONLY:
@@ -2248,13 +2371,25 @@ static void suffix_name(struct instr *instr) {
  * ensure they only get printed once), so we will need to watch out for
  * multiple prefixes, invalid instructions, etc.
  */
-int get_instr(dword ip, const byte *p, struct instr *instr, int bits) {
+/* The decode loop proper. Bitness is fixed per segment but steers branches
+ * all over the decoder, so this is instantiated below once per mode with
+ * bits as a compile-time constant; always_inline makes sure the constant
+ * actually propagates into the body and the helpers. */
+static inline int __attribute__((always_inline)) get_instr_bits(dword ip, const byte *p, struct instr *instr, const int bits) {
+    static int dispatch_built = 0;
     int len = 0;
     byte opcode;
     word prefix;
 
+    if (!dispatch_built) {
+        build_dispatch_tables();
+        dispatch_built = 1;
+    }
+
     memset(instr, 0, sizeof(*instr));
 
+    PERF_COUNT(instrs);
+
     while ((prefix = get_prefix(p[len], bits))) {
         if ((instr->prefix & PREFIX_SEG_MASK) && (prefix & PREFIX_SEG_MASK)) {
             instr->op = instructions[p[len]];
@@ -2312,14 +2447,8 @@ int get_instr(dword ip, const byte *p, struct instr *instr, int bits) {
         } else if (opcode >= 0xD8 && opcode <= 0xDF) {
             len += get_fpu_instr(p+len, &instr->op);
         } else {
-            unsigned i;
-            for (i=0; i<sizeof(instructions_group)/sizeof(struct op); i++) {
-                if (opcode == instructions_group[i].opcode &&
-                    subcode == instructions_group[i].subcode) {
-                    instr->op = instructions_group[i];
-                    break;
-                }
-            }
+            if (dispatch_group[opcode][subcode])
+                instr->op = *dispatch_group[opcode][subcode];
         }
 
         /* if we get here and we haven't found a suitable instruction,
@@ -2436,11 +2565,34 @@ int get_instr(dword ip, const byte *p, struct instr *instr, int bits) {
     return len;
 }
 
+int get_instr16(dword ip, const byte *p, struct instr *instr) {
+    return get_instr_bits(ip, p, instr, 16);
+}
+
+int get_instr32(dword ip, const byte *p, struct instr *instr) {
+    return get_instr_bits(ip, p, instr, 32);
+}
+
+int get_instr64(dword ip, const byte *p, struct instr *instr) {
+    return get_instr_bits(ip, p, instr, 64);
+}
+
+int get_instr(dword ip, const byte *p, struct instr *instr, int bits) {
+    if (bits == 16)
+        return get_instr16(ip, p, instr);
+    else if (bits == 32)
+        return get_instr32(ip, p, instr);
+    else
+        return get_instr64(ip, p, instr);
+}
+
 void print_instr(char *ip, const byte *p, int len, byte flags, struct instr *instr, const char *comment, int bits) {
     int i;
 
     /* FIXME: now that we've had to add bits to this function, get rid of ip_string */
 
+    syn = &syntax_info[asm_syntax];
+
     /* get the arguments */
 
     print_arg(ip, instr, 0, bits);
@@ -2466,105 +2618,160 @@ void print_instr(char *ip, const byte *p, int len, byte flags, struct instr *ins
         /* output a label, which is like an address but without the segment prefix */
         /* FIXME: check masm */
         if (asm_syntax == NASM)
-            printf(".");
-        printf("%s:", ip);
+            out_char('.');
+        out_str(ip);
+        out_char(':');
     }
 
-    if (!(opts & NO_SHOW_ADDRESSES))
-        printf("%s:", ip);
-    printf("\t");
+    if (!(opts & NO_SHOW_ADDRESSES)) {
+        out_str(ip);
+        out_char(':');
+    }
+    out_char('\t');
 
     if (!(opts & NO_SHOW_RAW_INSN)) {
-        for (i=0; i<len && i<7; i++)
-            printf("%02x ", p[i]);
+        for (i=0; i<len && i<7; i++) {
+            out_char(hex_lower[p[i] >> 4]);
+            out_char(hex_lower[p[i] & 0xf]);
+            out_char(' ');
+        }
         for (; i<8; i++)
-            printf("   ");
+            out_str("   ");
     }
 
     /* mark instructions that are jumped to */
     if ((flags & INSTR_JUMP) && !(opts & COMPILABLE))
-        printf((flags & INSTR_FAR) ? ">>" : " >");
+        out_str((flags & INSTR_FAR) ? ">>" : " >");
     else
-        printf("  ");
+        out_str("  ");
 
     /* print prefixes, including (fake) prefixes if ours are invalid */
     if (instr->prefix & PREFIX_SEG_MASK) {
         /* note: is it valid to use overrides with lods and outs? */
         if (!instr->usedmem || (instr->op.arg0 == ESDI || (instr->op.arg1 == ESDI && instr->op.arg0 != DSSI))) {  /* can't be overridden */
             warn_at("Segment prefix %s used with opcode 0x%02x %s\n", seg16[(instr->prefix & PREFIX_SEG_MASK)-1], instr->op.opcode, instr->op.name);
-            printf("%s ", seg16[(instr->prefix & PREFIX_SEG_MASK)-1]);
+            out_str(seg16[(instr->prefix & PREFIX_SEG_MASK)-1]);
+            out_char(' ');
         }
     }
     if ((instr->prefix & PREFIX_OP32) && instr->op.size != 16 && instr->op.size != 32) {
         warn_at("Operand-size override used with opcode 0x%02x %s\n", instr->op.opcode, instr->op.name);
-        printf((asm_syntax == GAS) ? "data32 " : "o32 "); /* fixme: how should MASM print it? */
+        out_str((asm_syntax == GAS) ? "data32 " : "o32 "); /* fixme: how should MASM print it? */
     }
     if ((instr->prefix & PREFIX_ADDR32) && (asm_syntax == NASM) && (instr->op.flags & OP_STRING)) {
-        printf("a32 ");
+        out_str("a32 ");
     } else if ((instr->prefix & PREFIX_ADDR32) && !instr->usedmem && instr->op.opcode != 0xE3) { /* jecxz */
         warn_at("Address-size prefix used with opcode 0x%02x %s\n", instr->op.opcode, instr->op.name);
-        printf((asm_syntax == GAS) ? "addr32 " : "a32 "); /* fixme: how should MASM print it? */
+        out_str((asm_syntax == GAS) ? "addr32 " : "a32 "); /* fixme: how should MASM print it? */
     }
     if (instr->prefix & PREFIX_LOCK) {
         if(!(instr->op.flags & OP_LOCK))
             warn_at("lock prefix used with opcode 0x%02x %s\n", instr->op.opcode, instr->op.name);
-        printf("lock ");
+        out_str("lock ");
     }
     if (instr->prefix & PREFIX_REPNE) {
         if(!(instr->op.flags & OP_REPNE))
             warn_at("repne prefix used with opcode 0x%02x %s\n", instr->op.opcode, instr->op.name);
-        printf("repne ");
+        out_str("repne ");
     }
     if (instr->prefix & PREFIX_REPE) {
         if(!(instr->op.flags & OP_REPE))
             warn_at("repe prefix used with opcode 0x%02x %s\n", instr->op.opcode, instr->op.name);
-        printf((instr->op.flags & OP_REPNE) ? "repe ": "rep ");
+        out_str((instr->op.flags & OP_REPNE) ? "repe ": "rep ");
     }
     if (instr->prefix & PREFIX_WAIT) {
-        printf("wait ");
+        out_str("wait ");
     }
 
     if (instr->vex)
-        printf("v");
-    printf("%s", instr->op.name);
+        out_char('v');
+    out_str(instr->op.name);
 
     if (instr->args[0].string[0] || instr->args[1].string[0])
-        printf("\t");
+        out_char('\t');
 
     if (asm_syntax == GAS) {
         /* fixme: are all of these orderings correct? */
-        if (instr->args[1].string[0])
-            printf("%s,", instr->args[1].string);
+        if (instr->args[1].string[0]) {
+            out_str(instr->args[1].string);
+            out_char(',');
+        }
         if (instr->vex_reg)
-            printf("%%ymm%d, ", instr->vex_reg);
+            out_fmt("%%ymm%d, ", instr->vex_reg);
         if (instr->args[0].string[0])
-            printf("%s", instr->args[0].string);
-        if (instr->args[2].string[0])
-            printf(",%s", instr->args[2].string);
+            out_str(instr->args[0].string);
+        if (instr->args[2].string[0]) {
+            out_char(',');
+            out_str(instr->args[2].string);
+        }
     } else {
         if (instr->args[0].string[0])
-            printf("%s", instr->args[0].string);
+            out_str(instr->args[0].string);
         if (instr->args[1].string[0])
-            printf(", ");
+            out_str(", ");
         if (instr->vex_reg)
-            printf("ymm%d, ", instr->vex_reg);
+            out_fmt("ymm%d, ", instr->vex_reg);
         if (instr->args[1].string[0])
-            printf("%s", instr->args[1].string);
-        if (instr->args[2].string[0])
-            printf(", %s", instr->args[2].string);
+            out_str(instr->args[1].string);
+        if (instr->args[2].string[0]) {
+            out_str(", ");
+            out_str(instr->args[2].string);
+        }
     }
     if (comment) {
-        printf(asm_syntax == GAS ? "\t// " : "\t;");
-        printf(" <%s>", comment);
+        out_str(asm_syntax == GAS ? "\t// " : "\t;");
+        out_fmt(" <%s>", comment);
     }
 
     /* if we have more than 7 bytes on this line, wrap around */
     if (len > 7 && !(opts & NO_SHOW_RAW_INSN)) {
-        printf("\n\t\t");
+        out_str("\n\t\t");
         for (i=7; i<len; i++) {
-            printf("%02x", p[i]);
-            if (i < len) printf(" ");
+            out_char(hex_lower[p[i] >> 4]);
+            out_char(hex_lower[p[i] & 0xf]);
+            if (i < len) out_char(' ');
         }
     }
-    printf("\n");
+    out_char('\n');
+}
+
+/* Decode a straight run of instructions beginning at relip into a block.
+ * start, base, length and min_alloc describe the region the same way
+ * print_disassembly() sees it: file offset, load address, data length, and
+ * the point past which bytes hang over the region. The run ends at the
+ * block size, at the end of the region, or at the first byte the scanner
+ * didn't mark as an instruction (with -D, at the first zero filler byte
+ * instead); the caller formats the block, skips ahead, and comes back for
+ * the next run. */
+unsigned decode_block(struct instr_block *block, off_t start, dword base,
+    dword relip, dword length, dword min_alloc, const byte *instr_flags, int bits)
+{
+    int (*decode)(dword ip, const byte *p, struct instr *instr);
+    unsigned n = 0;
+    int len;
+
+    /* bitness is fixed per region; pick the specialized decoder once */
+    decode = (bits == 16) ? get_instr16 : (bits == 32) ? get_instr32 : get_instr64;
+
+    while (n < INSTR_BLOCK_SIZE && relip < length && relip < min_alloc) {
+        if (!(instr_flags[relip] & INSTR_VALID) &&
+            (!(opts & DISASSEMBLE_ALL) || read_byte(start + relip) == 0))
+            break;
+
+        /* Instructions can "hang over" the end of a segment.
+         * Zero should be supplied. */
+        memset(block->bytes[n], 0, sizeof(block->bytes[n]));
+        memcpy(block->bytes[n], read_data(start + relip), min(sizeof(block->bytes[n]), length - relip));
+
+        memset(&block->instr[n], 0, sizeof(block->instr[n]));
+        len = decode(base + relip, block->bytes[n], &block->instr[n]);
+
+        block->ip[n] = relip;
+        block->len[n] = len;
+        n++;
+        relip += len;
+    }
+
+    block->count = n;
+    return n;
 }
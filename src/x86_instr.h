@@ -138,6 +138,12 @@ struct instr {
 };
 
 extern int get_instr(dword ip, const byte *p, struct instr *instr, int bits);
+
+/* Bitness-specialized variants of get_instr(); pick one per segment instead
+ * of re-branching on the mode for every instruction. */
+extern int get_instr16(dword ip, const byte *p, struct instr *instr);
+extern int get_instr32(dword ip, const byte *p, struct instr *instr);
+extern int get_instr64(dword ip, const byte *p, struct instr *instr);
 extern void print_instr(char *ip, const byte *p, int len, byte flags, struct instr *instr, const char *comment, int bits);
 
 /* 66 + 67 + seg + lock/rep + 2 bytes opcode + modrm + sib + 4 bytes displacement + 4 bytes immediate */
@@ -151,4 +157,20 @@ extern void print_instr(char *ip, const byte *p, int len, byte flags, struct ins
 #define INSTR_FAR       0x10    /* instruction is target of far call/jmp */
 #define INSTR_RELOC     0x20    /* byte has relocation data */
 
+/* A run of instructions decoded in one pass by decode_block() and formatted
+ * in a second, so the decode tables and the formatting code each stay hot
+ * for a while instead of evicting each other on every instruction. */
+#define INSTR_BLOCK_SIZE 64
+
+struct instr_block {
+    struct instr instr[INSTR_BLOCK_SIZE];
+    byte bytes[INSTR_BLOCK_SIZE][MAX_INSTR];
+    dword ip[INSTR_BLOCK_SIZE];     /* relative to the section or segment */
+    byte len[INSTR_BLOCK_SIZE];
+    unsigned count;
+};
+
+extern unsigned decode_block(struct instr_block *block, off_t start, dword base,
+    dword relip, dword length, dword min_alloc, const byte *instr_flags, int bits);
+
 #endif /* __X86_INSTR_H */
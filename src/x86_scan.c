@@ -0,0 +1,103 @@
+/*
+ * Shared code-flow scanner
+ *
+ * Copyright 2017-2018,2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "semblance.h"
+#include "x86_instr.h"
+#include "x86_scan.h"
+
+/* Branch targets pending a scan. Targets are pushed here instead of
+ * recursing on them; packed binaries with dense branching used to take
+ * the recursive scanner past the stack limit. */
+static qword *scan_queue;
+static unsigned scan_queue_count, scan_queue_alloc;
+
+void scan_push(qword target) {
+    if (scan_queue_count == scan_queue_alloc) {
+        scan_queue_alloc = scan_queue_alloc ? scan_queue_alloc * 2 : 64;
+        scan_queue = realloc(scan_queue, scan_queue_alloc * sizeof(*scan_queue));
+    }
+    scan_queue[scan_queue_count++] = target;
+}
+
+void scan_run(const struct scan_format *fmt) {
+    byte buffer[MAX_INSTR];
+    struct instr instr;
+    struct scan_region reg;
+    int (*decode)(dword ip, const byte *p, struct instr *instr);
+    int instr_length;
+    dword relip, i;
+
+    while (scan_queue_count) {
+        qword target = scan_queue[--scan_queue_count];
+
+        if (!fmt->resolve(target, &reg, &relip, fmt->ctx))
+            continue;
+
+        /* bitness is fixed per region; pick the specialized decoder once */
+        decode = (reg.bits == 16) ? get_instr16 : (reg.bits == 32) ? get_instr32 : get_instr64;
+
+        if (relip < reg.min_alloc &&
+            (reg.flags[relip] & (INSTR_VALID|INSTR_SCANNED)) == INSTR_SCANNED)
+            fmt->warning(reg.base + relip, "Attempt to scan byte that does not begin instruction.\n", fmt->ctx);
+
+        while (relip < reg.length) {
+            /* data can "hang over" the end of the region; don't walk into it */
+            if (relip >= reg.min_alloc) {
+                fmt->warning(reg.base + relip, fmt->end_msg, fmt->ctx);
+                break;
+            }
+
+            /* check if we already read from here */
+            if (reg.flags[relip] & INSTR_SCANNED) break;
+
+            /* read the instruction */
+            memset(buffer, 0, sizeof(buffer));
+            memcpy(buffer, read_data(reg.start + relip), min(sizeof(buffer), reg.length - relip));
+            instr_length = decode(reg.base + relip, buffer, &instr);
+
+            /* mark the bytes */
+            reg.flags[relip] |= INSTR_VALID;
+            for (i = relip; i < relip + instr_length && i < reg.min_alloc; i++)
+                reg.flags[i] |= INSTR_SCANNED;
+
+            /* instruction which hangs over the minimum allocation */
+            if (i < relip + instr_length && i == reg.min_alloc) {
+                fmt->warning(reg.base + relip, fmt->end_msg, fmt->ctx);
+                break;
+            }
+
+            /* follow branches and relocations */
+            fmt->visit(&instr, relip, instr_length, &reg, fmt->ctx);
+
+            if (instr.op.flags & OP_STOP)
+                break;
+
+            relip += instr_length;
+        }
+
+        if (relip >= reg.length)
+            fmt->warning(reg.base + relip, fmt->end_msg, fmt->ctx);
+    }
+}
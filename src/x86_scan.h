@@ -0,0 +1,65 @@
+/*
+ * Shared code-flow scanner
+ *
+ * Copyright 2017-2018,2020 Zebediah Figura
+ *
+ * This file is part of Semblance.
+ *
+ * Semblance is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Semblance is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Semblance; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __X86_SCAN_H
+#define __X86_SCAN_H
+
+#include "semblance.h"
+#include "x86_instr.h"
+
+/* One contiguous run of scannable bytes: the whole load image for MZ, a
+ * segment for NE, a section for PE. */
+struct scan_region {
+    off_t start;        /* file offset of the region's first byte */
+    dword base;         /* address the disassembler sees for that byte */
+    dword length;       /* bytes present in the file */
+    dword min_alloc;    /* bytes addressable once loaded */
+    byte *flags;        /* per-byte instruction flags (min_alloc of them) */
+    int bits;
+};
+
+/* The worklist engine handles everything the three containers have in
+ * common—the pending-target queue, the decode loop, flag marking, and
+ * hang-over detection—and calls back into the format for the parts that
+ * differ: turning a queued target into a region, and following branches
+ * and relocations out of a decoded instruction. */
+struct scan_format {
+    /* Map a queued target to its region and the offset within it. Return
+     * zero if the target lies outside the image; the callback prints its
+     * own warning, since every format names addresses differently. */
+    int (*resolve)(qword target, struct scan_region *reg, dword *relip, void *ctx);
+    /* Process one decoded instruction: mark branch and relocation targets
+     * and push them with scan_push(). The engine has already marked the
+     * instruction's own bytes. */
+    void (*visit)(struct instr *instr, dword relip, int instr_length,
+        const struct scan_region *reg, void *ctx);
+    /* Print a warning for the given address. (Not "warn"; that's a macro.) */
+    void (*warning)(qword addr, const char *msg, void *ctx);
+    /* "Scan reached the end of segment.\n" or the section equivalent. */
+    const char *end_msg;
+    void *ctx;
+};
+
+extern void scan_push(qword target);
+extern void scan_run(const struct scan_format *fmt);
+
+#endif /* __X86_SCAN_H */